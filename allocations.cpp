@@ -0,0 +1,210 @@
+// Heap use of dispatch(): replaces the global allocator with a counting one and
+// runs a matrix of machines, covering reactions, transitions, shallow and deep
+// history, transition tables and orthogonal regions with transition actions,
+// through a few rounds of their event scripts. The first round starts the
+// machine; any allocation in the rounds after it fails the `allocations` test.
+// Also prints the time per event; tracing is disabled.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "metahsm.hpp"
+
+using namespace metahsm;
+
+namespace {
+std::size_t allocations = 0;
+}
+
+void* operator new(std::size_t size) {
+  allocations++;
+  if (void* memory = std::malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  allocations++;
+  const std::size_t align = static_cast<std::size_t>(alignment);
+  if (void* memory = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+    return memory;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept { allocations++; return std::malloc(size ? size : 1); }
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept { allocations++; return std::malloc(size ? size : 1); }
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+
+struct Toggle {};
+struct Step {};
+struct Count {};
+struct EnterShallow {};
+struct EnterDeep {};
+struct Leave {};
+struct Swap {};
+
+struct FlatTopState : State<FlatTopState>
+{
+  struct Off : State
+  {
+    inline void react(Toggle) { transition<On>(); }
+  };
+  struct On : State
+  {
+    inline void react(Toggle) { transition<Off>(); }
+    inline void react(Count) { context<FlatTopState>().count++; }
+  };
+  using SubStates = std::tuple<Off, On>;
+  int count = 0;
+};
+
+struct HistoryTopState : State<HistoryTopState>
+{
+  static constexpr bool publish_configuration = true;
+  struct Active;
+  struct Idle : State
+  {
+    inline void react(EnterShallow) { transition<History<Active>::Shallow>(); }
+    inline void react(EnterDeep) { transition<History<Active>::Deep>(); }
+  };
+  struct Active : State
+  {
+    struct Second;
+    struct First : State
+    {
+      struct Ready : State
+      {
+        inline void react(Step) { transition<Busy>(); }
+      };
+      struct Busy : State
+      {
+        inline void react(Step) { transition<Ready>(); }
+      };
+      inline void react(Swap) { transition<Second>(); }
+      using SubStates = std::tuple<Ready, Busy>;
+    };
+    struct Second : State
+    {
+      inline void react(Swap) { transition<First>(); }
+    };
+    inline void react(Leave) { transition<Idle>(); }
+    inline void react(Count) { context<HistoryTopState>().count++; }
+    using SubStates = std::tuple<First, Second>;
+  };
+  using SubStates = std::tuple<Idle, Active>;
+  int count = 0;
+};
+
+struct TableTopState : State<TableTopState>
+{
+  struct Tally
+  {
+    template <typename State_>
+    void operator()(State_& state, Toggle const&) const { state.template context<TableTopState>().count++; }
+  };
+  struct Even
+  {
+    template <typename State_>
+    bool operator()(State_& state, Toggle const&) const { return state.template context<TableTopState>().count % 2 == 0; }
+  };
+  struct Off : State
+  { };
+  struct On : State
+  { };
+  using SubStates = std::tuple<Off, On>;
+  using Transitions = std::tuple<
+    Transition<Off, Toggle, On, Even, Tally>,
+    Transition<Off, Toggle, Off, void, Tally>,
+    Transition<On, Toggle, Off>>;
+  int count = 0;
+};
+
+struct OrthogonalTopState : State<OrthogonalTopState>
+{
+  using ConflictPolicy = InnerFirst;
+  struct Running : State
+  {
+    struct Left : Region
+    {
+      struct Down;
+      struct Up : State
+      {
+        inline void react(Step) {
+          transition<Down>();
+          transition_action(&Up::record);
+        }
+        inline void record() { context<OrthogonalTopState>().actions++; }
+      };
+      struct Down : State
+      {
+        inline void react(Step) {
+          transition<Up>();
+          transition_action([this] { context<OrthogonalTopState>().actions++; });
+        }
+      };
+      using SubStates = std::tuple<Up, Down>;
+    };
+    struct Right : Region
+    {
+      struct Fast : State
+      {
+        inline void react(Step) { transition<Slow>(); }
+        inline void react(Toggle) {
+          transition<Left::Down>();
+          transition_action([this] { context<OrthogonalTopState>().actions += 2; });
+        }
+      };
+      struct Slow : State
+      {
+        inline void react(Step) { transition<Fast>(); }
+      };
+      using SubStates = std::tuple<Fast, Slow>;
+    };
+    inline void react(Toggle) { transition<Left::Up>(); }
+    using Regions = std::tuple<Left, Right>;
+  };
+  using SubStates = std::tuple<Running>;
+  int actions = 0;
+};
+
+constexpr int rounds = 10000;
+bool allocation_free = true;
+
+template <typename TopState_, typename ... Event_>
+void run(char const* name) {
+  StateMachine<TopState_> machine;
+  auto round = [&] { (machine.dispatch(Event_{}), ...); };
+  round();
+  allocations = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    round();
+  }
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+  std::printf("%-12s %8zu events %6zu allocations %7.1f ns/event\n", name, rounds * sizeof...(Event_), allocations,
+      elapsed.count() / (rounds * sizeof...(Event_)));
+  allocation_free = allocation_free && allocations == 0;
+}
+
+int main() {
+  run<FlatTopState, Toggle, Count, Toggle, Count>("flat");
+  run<HistoryTopState, EnterDeep, Step, Count, Leave, EnterShallow, Swap, Leave, EnterDeep, Swap, Step, Leave>("history");
+  run<TableTopState, Toggle, Toggle, Toggle>("table");
+  run<OrthogonalTopState, Step, Toggle, Step, Step, Toggle>("orthogonal");
+  if (!allocation_free) {
+    std::printf("dispatch allocated\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Code-size benchmark: one connection sub-machine (StateTemplate) instantiated
+// six times as orthogonal regions of a single machine (61 of the 64 states a
+// machine may have), built twice: on typed wrappers, and with
+// BENCH_SHARED_BODY on the shared engine (see SharedCompositeWrapper). The
+// build prints the section sizes of both executables; the shared build trades
+// text for per-instantiation tables in data.
+#include <cstddef>
+#include <utility>
+#include "metahsm.hpp"
+
+#ifndef BENCH_SHARED_BODY
+#define BENCH_SHARED_BODY 0
+#endif
+
+using namespace metahsm;
+
+enum ConnectionEvent
+{
+  CONNECT,
+  DATA,
+  DROP,
+  TIMEOUT
+};
+
+template <auto e>
+struct Event{};
+
+template <typename Config>
+struct Connection : StateTemplate<Connection>, Config
+{
+  static constexpr bool shared_body = BENCH_SHARED_BODY;
+  struct Idle : State, Config
+  {
+    inline void react(Event<CONNECT>) { transition<Connecting>(); }
+  };
+  struct Connecting : State, Config
+  {
+    struct Resolving : State, Config
+    {
+      inline void react(Event<DATA>) { transition<Handshaking>(); }
+    };
+    struct Handshaking : State, Config
+    {
+      inline void react(Event<DATA>) { transition<typename Connected::Streaming>(); }
+    };
+    inline void react(Event<TIMEOUT>) { transition<Idle>(); }
+    using SubStates = std::tuple<Resolving, Handshaking>;
+  };
+  struct Connected : State, Config
+  {
+    struct Streaming : State, Config
+    {
+      struct Fast : State, Config
+      {
+        inline void react(Event<TIMEOUT>) { transition<Slow>(); }
+      };
+      struct Slow : State, Config
+      {
+        inline void react(Event<DATA>) { transition<Fast>(); }
+      };
+      inline void on_entry() { context<Connection>().streams++; }
+      using SubStates = std::tuple<Fast, Slow>;
+    };
+    struct Draining : State, Config
+    {
+      inline void react(Event<DATA>) { context<Connection>().received++; }
+    };
+    inline void react(Event<DROP>) { transition<Draining>(); }
+    inline void react(Event<TIMEOUT>) { transition<Idle>(); }
+    using SubStates = std::tuple<Streaming, Draining>;
+  };
+  using SubStates = std::tuple<Idle, Connecting, Connected>;
+  int received = 0;
+  int streams = 0;
+};
+
+struct BenchTopState;
+
+template <std::size_t I>
+struct Slot : TopStateRebind<BenchTopState>
+{};
+
+template <typename Indices>
+struct Slots;
+
+template <std::size_t ... I>
+struct Slots<std::index_sequence<I...>>
+{
+  using type = std::tuple<Connection<Slot<I>>...>;
+};
+
+struct BenchTopState : State<BenchTopState>
+{
+  using Regions = Slots<std::make_index_sequence<6>>::type;
+};
+
+int main() {
+  StateMachine<BenchTopState> sm;
+  for (int i = 0; i < 4; i++) {
+    sm.dispatch<Event<CONNECT>>();
+    sm.dispatch<Event<DATA>>();
+    sm.dispatch<Event<DATA>>();
+    sm.dispatch<Event<TIMEOUT>>();
+    sm.dispatch<Event<DATA>>();
+    sm.dispatch<Event<DROP>>();
+    sm.dispatch<Event<DATA>>();
+    sm.dispatch<Event<TIMEOUT>>();
+  }
+  return 0;
+}
@@ -0,0 +1,54 @@
+// Compile-time benchmark for the state hierarchy traits: builds a machine of
+// 1 + 5 + 25 + 125 states and instantiates state ids and ancestor lists for all
+// of them. Time the build of this target to track metaprogramming cost, e.g.
+//   cmake --build <build> --target bench_compile -- -B
+// The machine is too large for a 64-bit state combination, so only the type
+// traits are exercised, not StateMachine.
+#include <cstddef>
+#include "metahsm.hpp"
+
+using namespace metahsm;
+
+template <typename TopState_, std::size_t Id_, std::size_t Depth_>
+struct Node : State<TopState_>
+{
+  using SubStates = std::tuple<
+    Node<TopState_, Id_ * 5 + 1, Depth_ - 1>,
+    Node<TopState_, Id_ * 5 + 2, Depth_ - 1>,
+    Node<TopState_, Id_ * 5 + 3, Depth_ - 1>,
+    Node<TopState_, Id_ * 5 + 4, Depth_ - 1>,
+    Node<TopState_, Id_ * 5 + 5, Depth_ - 1>>;
+};
+
+template <typename TopState_, std::size_t Id_>
+struct Node<TopState_, Id_, 0> : State<TopState_>
+{};
+
+struct BenchTopState : State<BenchTopState>
+{
+  using SubStates = std::tuple<
+    Node<BenchTopState, 1, 2>,
+    Node<BenchTopState, 2, 2>,
+    Node<BenchTopState, 3, 2>,
+    Node<BenchTopState, 4, 2>,
+    Node<BenchTopState, 5, 2>>;
+};
+
+template <typename ... State_>
+constexpr std::size_t sum_of_ids(type_identity<std::tuple<State_...>>) {
+  return (state_id_v<State_> + ...);
+}
+
+template <typename ... State_>
+constexpr std::size_t sum_of_depths(type_identity<std::tuple<State_...>>) {
+  return (std::tuple_size_v<super_state_recursive_t<State_>> + ...);
+}
+
+using BenchStates = all_states_t<BenchTopState>;
+static_assert(std::tuple_size_v<BenchStates> == 156);
+static_assert(sum_of_ids(type_identity<BenchStates>{}) == 155 * 156 / 2);
+static_assert(sum_of_depths(type_identity<BenchStates>{}) == 5 * 1 + 25 * 2 + 125 * 3);
+
+int main() {
+  return 0;
+}
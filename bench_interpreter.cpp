@@ -0,0 +1,112 @@
+// Runtime benchmark: the same table-driven machine run by StateMachine and by
+// the Interpreter built from its description. Prints the time per event of
+// both; build with optimizations, tracing is disabled.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include "metahsm.hpp"
+#include "interpreter.hpp"
+
+using namespace metahsm;
+
+enum MediaEvent
+{
+  POWER,
+  PLAY,
+  STOP,
+  SPEED,
+  VOLUME
+};
+
+template <auto e>
+struct Event{};
+
+struct MediaTopState : State<MediaTopState>
+{
+  struct Off : State
+  { };
+  struct On : State
+  {
+    struct Media : Region
+    {
+      struct Stopped : State
+      { };
+      struct Playing : State
+      {
+        struct Normal : State
+        { };
+        struct Fast : State
+        { };
+        using SubStates = std::tuple<Normal, Fast>;
+      };
+      using SubStates = std::tuple<Stopped, Playing>;
+    };
+    struct Volume : Region
+    {
+      struct Quiet : State
+      { };
+      struct Loud : State
+      { };
+      using SubStates = std::tuple<Quiet, Loud>;
+    };
+    using Regions = std::tuple<Media, Volume>;
+  };
+  using SubStates = std::tuple<Off, On>;
+
+  struct Quieten
+  {
+    void operator()(On::Volume::Loud& loud, Event<VOLUME> const&) const { loud.context<MediaTopState>().quietened++; }
+  };
+  using Transitions = std::tuple<
+    Transition<Off, Event<POWER>, History<On>::Deep>,
+    Transition<On, Event<POWER>, Off>,
+    Transition<On::Media::Stopped, Event<PLAY>, On::Media::Playing>,
+    Transition<On::Media::Playing, Event<STOP>, On::Media::Stopped>,
+    Transition<On::Media::Playing::Normal, Event<SPEED>, On::Media::Playing::Fast>,
+    Transition<On::Media::Playing::Fast, Event<SPEED>, On::Media::Playing::Normal>,
+    Transition<On::Volume::Quiet, Event<VOLUME>, On::Volume::Loud>,
+    Transition<On::Volume::Loud, Event<VOLUME>, On::Volume::Quiet, void, Quieten>>;
+  int quietened = 0;
+};
+
+using MediaEvents = std::tuple<Event<POWER>, Event<PLAY>, Event<STOP>, Event<SPEED>, Event<VOLUME>>;
+
+constexpr MediaEvent script[] = {POWER, PLAY, SPEED, VOLUME, SPEED, VOLUME, STOP, POWER, PLAY, POWER, SPEED, STOP, VOLUME, POWER};
+constexpr std::size_t rounds = 200000;
+
+template <typename Run_>
+double nanoseconds_per_event(Run_ && run) {
+  const auto begin = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < rounds; i++) {
+    for (MediaEvent event : script) {
+      run(event);
+    }
+  }
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+  return elapsed.count() / (rounds * std::size(script));
+}
+
+int main() {
+  StateMachine<MediaTopState> sm;
+  const double compiled = nanoseconds_per_event([&](MediaEvent event) {
+    switch (event) {
+      case POWER: sm.dispatch<Event<POWER>>(); break;
+      case PLAY: sm.dispatch<Event<PLAY>>(); break;
+      case STOP: sm.dispatch<Event<STOP>>(); break;
+      case SPEED: sm.dispatch<Event<SPEED>>(); break;
+      case VOLUME: sm.dispatch<Event<VOLUME>>(); break;
+    }
+  });
+
+  int quietened = 0;
+  Interpreter interpreter{describe<MediaTopState, MediaEvents>(), {&quietened, nullptr,
+    [](void* context, std::uint16_t, const void*) { ++*static_cast<int*>(context); }}};
+  const double interpreted = nanoseconds_per_event([&](MediaEvent event) {
+    interpreter.dispatch(event);
+  });
+
+  std::printf("compiled:    %6.1f ns/event\n", compiled);
+  std::printf("interpreted: %6.1f ns/event\n", interpreted);
+  const bool same = interpreter.active_states() == sm.active_states() && quietened == sm.get_state<MediaTopState>().quietened;
+  return same ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+// Runtime benchmark for the state storage layout: many instances of a machine
+// whose active path runs eight levels deep, every level with two large error
+// states next to it. Events toggle the innermost states of instances in random
+// order, so most dispatches start from a cold cache. Prints, per layout, the
+// cache lines spanned by the storage of the active path and the best time per
+// event of a few runs; build with optimizations, tracing is disabled.
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+#include "metahsm.hpp"
+
+using namespace metahsm;
+
+struct Toggle {};
+
+constexpr std::size_t depth = 6;
+
+template <typename TopState_, std::size_t Level_, std::size_t Index_>
+struct Error : State<TopState_>
+{
+  std::array<std::uint64_t, 32> log{};
+};
+
+template <typename TopState_, std::size_t Level_>
+struct Path;
+
+template <typename TopState_, std::size_t Level_>
+using Level = std::tuple<Path<TopState_, Level_>, Error<TopState_, Level_, 0>, Error<TopState_, Level_, 1>>;
+
+template <typename TopState_, std::size_t Level_>
+struct Path : State<TopState_>
+{
+  using SubStates = Level<TopState_, Level_ - 1>;
+  std::uint32_t visits = 0;
+};
+
+template <typename TopState_>
+struct Path<TopState_, 0> : State<TopState_>
+{
+  struct Off;
+  struct On : State<TopState_>
+  {
+    inline void react(Toggle) { this->template transition<Off>(); }
+  };
+  struct Off : State<TopState_>
+  {
+    inline void react(Toggle) { this->template transition<On>(); }
+  };
+  using SubStates = std::tuple<On, Off>;
+};
+
+// all_states_t of the machine, spelled out so a top state can name it
+template <typename TopState_, std::size_t Level_>
+struct declaration_order
+{
+  using type = tuple_join_t<Level<TopState_, Level_>, typename declaration_order<TopState_, Level_ - 1>::type>;
+};
+
+template <typename TopState_>
+struct declaration_order<TopState_, 0>
+{
+  using type = tuple_join_t<Level<TopState_, 0>, std::tuple<typename Path<TopState_, 0>::On, typename Path<TopState_, 0>::Off>>;
+};
+
+template <typename TopState_, std::size_t Level_>
+struct error_states
+{
+  using type = tuple_join_t<std::tuple<Error<TopState_, Level_, 0>, Error<TopState_, Level_, 1>>,
+      typename error_states<TopState_, Level_ - 1>::type>;
+};
+
+template <typename TopState_>
+struct error_states<TopState_, 0>
+{
+  using type = std::tuple<Error<TopState_, 0, 0>, Error<TopState_, 0, 1>>;
+};
+
+struct DeclarationOrder
+{
+  template <typename TopState_>
+  using HotStates = tuple_join_t<TopState_, typename declaration_order<TopState_, depth>::type>;
+  template <typename TopState_>
+  using ColdStates = std::tuple<>;
+};
+
+struct DepthFirst
+{
+  template <typename TopState_>
+  using HotStates = std::tuple<>;
+  template <typename TopState_>
+  using ColdStates = std::tuple<>;
+};
+
+struct ColdErrors
+{
+  template <typename TopState_>
+  using HotStates = std::tuple<>;
+  template <typename TopState_>
+  using ColdStates = typename error_states<TopState_, depth>::type;
+};
+
+template <typename Layout_>
+struct SpineTopState : State<SpineTopState<Layout_>>
+{
+  using SubStates = Level<SpineTopState, depth>;
+  using HotStates = typename Layout_::template HotStates<SpineTopState>;
+  using ColdStates = typename Layout_::template ColdStates<SpineTopState>;
+};
+
+static_assert(std::is_same_v<storage_order_t<SpineTopState<DeclarationOrder>>, all_states_t<SpineTopState<DeclarationOrder>>>);
+
+template <typename TopState_, std::size_t ... Level_>
+std::size_t path_cache_lines(StateMachine<TopState_>& machine, std::index_sequence<Level_...>) {
+  std::array<std::uintptr_t, sizeof...(Level_) + 2> lines{
+    reinterpret_cast<std::uintptr_t>(&machine.template get_state<TopState_>()) / 64,
+    (reinterpret_cast<std::uintptr_t>(&machine.template get_state<Path<TopState_, Level_>>()) / 64)...,
+    reinterpret_cast<std::uintptr_t>(&machine.template get_state<typename Path<TopState_, 0>::On>()) / 64};
+  std::sort(lines.begin(), lines.end());
+  return std::unique(lines.begin(), lines.end()) - lines.begin();
+}
+
+constexpr std::size_t instances = 8192;
+constexpr std::size_t rounds = 16;
+constexpr std::size_t attempts = 5;
+
+template <typename Layout_>
+void run(char const* name, std::vector<std::uint32_t> const& order) {
+  using Machine = StateMachine<SpineTopState<Layout_>>;
+  auto machines = std::make_unique<Machine[]>(instances);
+  double best = 0;
+  for (std::size_t attempt = 0; attempt < attempts; attempt++) {
+    const auto begin = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; r++) {
+      for (std::uint32_t i : order) {
+        machines[i].dispatch(Toggle{});
+      }
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    const double per_event = elapsed.count() / (rounds * instances);
+    best = attempt == 0 ? per_event : std::min(best, per_event);
+  }
+  std::printf("%-18s %6zu bytes/machine %2zu path cache lines %7.1f ns/event\n", name, sizeof(Machine),
+      path_cache_lines(machines[0], std::make_index_sequence<depth + 1>()), best);
+}
+
+int main() {
+  std::vector<std::uint32_t> order(instances);
+  for (std::uint32_t i = 0; i < instances; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937{42});
+  run<DeclarationOrder>("declaration order", order);
+  run<DepthFirst>("depth-first", order);
+  run<ColdErrors>("cold errors apart", order);
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <tuple>
+#include <variant>
+
+#include "metahsm.hpp"
+#include "spsc.hpp"
+
+namespace metahsm {
+
+// Events a machine accepts over the bus, declared on its top state as
+// `using Mailbox = std::variant<...>`.
+template <typename TopState_>
+using mailbox_t = typename TopState_::Mailbox;
+
+template <typename TopState_>
+struct Envelope
+{
+  std::uint32_t instance;
+  mailbox_t<TopState_> event;
+};
+
+// Per-thread route to the channel a worker thread uses to reach TopState_.
+// Set by Bus::bind(), used by StateImplBase::send().
+template <typename TopState_>
+struct Route
+{
+  static inline thread_local void* channel = nullptr;
+  static inline thread_local bool (*push)(void*, Envelope<TopState_> const&) = nullptr;
+  static inline thread_local std::atomic<bool>* ready = nullptr;
+
+  template <typename Event_>
+  static bool send(Event_ const& event, std::uint32_t instance) {
+    if (!channel || !push(channel, Envelope<TopState_>{instance, event})) {
+      return false;
+    }
+    // Pairs with the fence in Bus::drain(): either this sees the flag cleared
+    // by a drain, or that drain sees the message. Only the first message
+    // after a drain pays for the wakeup.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!ready->load(std::memory_order_relaxed)) {
+      ready->store(true, std::memory_order_release);
+#if defined(__cpp_lib_atomic_wait)
+      ready->notify_one();
+#endif
+    }
+    return true;
+  }
+};
+
+// Message bus between the machines with the given top states. Every worker
+// thread gets its own preallocated SPSC channel to every machine type, so
+// sending never locks or allocates; a full channel rejects the message and
+// counts it.
+template <std::size_t Capacity_, std::size_t Workers_, typename ... TopState_>
+class Bus
+{
+public:
+  template <typename TopState__>
+  using Channel = SpscChannel<Envelope<TopState__>, Capacity_>;
+
+  // Binds the calling thread as the given worker; send() from react() on this
+  // thread then goes through that worker's channels.
+  void bind(std::size_t worker) {
+    (bind<TopState_>(worker), ...);
+  }
+
+  // Wakeup flag of a machine type, set when a message arrived since its last drain.
+  template <typename Target_>
+  bool ready() const {
+    return std::get<Inbox<Target_>>(inboxes_).ready.load(std::memory_order_acquire);
+  }
+
+  // Blocks the consumer of Target_ until a message arrives.
+  template <typename Target_>
+  void wait() {
+    auto& inbox = std::get<Inbox<Target_>>(inboxes_);
+    while (!inbox.ready.load(std::memory_order_acquire)) {
+#if defined(__cpp_lib_atomic_wait)
+      inbox.ready.wait(false, std::memory_order_acquire);
+#else
+      std::this_thread::yield();
+#endif
+    }
+  }
+
+  // Dispatches up to max_batch messages per worker channel to the machine
+  // returned by resolve(instance). Returns the number of messages dispatched.
+  // Messages left over by max_batch keep the wakeup flag set.
+  template <typename Target_, typename Resolve_>
+  std::size_t drain(Resolve_ && resolve, std::size_t max_batch = Capacity_) {
+    auto& inbox = std::get<Inbox<Target_>>(inboxes_);
+    inbox.ready.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::size_t count = 0;
+    for (auto& channel : inbox.channels) {
+      count += channel.drain([&](Envelope<Target_> const& envelope) {
+        StateMachine<Target_>& state_machine = resolve(envelope.instance);
+        visit([&](auto const& event) {
+          state_machine.template dispatch<std::remove_cv_t<std::remove_reference_t<decltype(event)>>>(event);
+        }, envelope.event);
+      }, max_batch);
+      if (!channel.empty()) {
+        inbox.ready.store(true, std::memory_order_relaxed);
+      }
+    }
+    return count;
+  }
+
+  template <typename Target_>
+  std::size_t drain(StateMachine<Target_>& state_machine, std::size_t max_batch = Capacity_) {
+    return drain<Target_>([&](std::uint32_t) -> StateMachine<Target_>& { return state_machine; }, max_batch);
+  }
+
+  // Backpressure: messages from a worker to Target_ rejected because the channel was full.
+  template <typename Target_>
+  std::size_t rejected(std::size_t worker) const {
+    return std::get<Inbox<Target_>>(inboxes_).channels[worker].rejected();
+  }
+
+  template <typename Target_>
+  std::size_t sent(std::size_t worker) const {
+    return std::get<Inbox<Target_>>(inboxes_).channels[worker].pushed();
+  }
+
+private:
+  template <typename Target_>
+  struct Inbox
+  {
+    std::array<Channel<Target_>, Workers_> channels;
+    alignas(cache_line_size) std::atomic<bool> ready{false};
+  };
+
+  template <typename Target_>
+  void bind(std::size_t worker) {
+    auto& inbox = std::get<Inbox<Target_>>(inboxes_);
+    Route<Target_>::channel = &inbox.channels[worker];
+    Route<Target_>::push = [](void* channel, Envelope<Target_> const& envelope) {
+      return static_cast<Channel<Target_>*>(channel)->push(envelope);
+    };
+    Route<Target_>::ready = &inbox.ready;
+  }
+
+  std::tuple<Inbox<TopState_>...> inboxes_;
+};
+
+}
@@ -0,0 +1,182 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+#include <variant>
+
+#include "metahsm.hpp"
+
+namespace metahsm {
+
+// Frame storage of a coroutine state, preallocated inside the state itself.
+struct CoroutineFrame
+{
+  // internal
+  std::byte* frame_storage_ = nullptr;
+  std::size_t frame_capacity_ = 0;
+};
+
+// Return type of a coroutine state's run(). The frame is placed in the state's
+// storage. Its size is only known once the compiler has laid it out, at the
+// first entry of the state: a frame larger than the state's FrameSize
+// terminates the program right there instead of leaving the state inert.
+class Script
+{
+public:
+  struct promise_type
+  {
+    static void* operator new(std::size_t size, CoroutineFrame& state) {
+      if (size > state.frame_capacity_) {
+        // raise the FrameSize of the CoroutineState
+        std::terminate();
+      }
+      return state.frame_storage_;
+    }
+    // scripts must be member functions of a coroutine state
+    static void* operator new(std::size_t) = delete;
+    static void operator delete(void*, std::size_t) noexcept {}
+
+    Script get_return_object() { return Script{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  Script() = default;
+  Script(Script const&) = delete;
+  Script(Script && other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+  Script& operator=(Script && other) noexcept {
+    reset();
+    handle_ = std::exchange(other.handle_, {});
+    return *this;
+  }
+  ~Script() { reset(); }
+
+  bool done() const { return !handle_ || handle_.done(); }
+
+  // Destroys the frame, running the destructors of the script's locals.
+  void reset() {
+    if (handle_) {
+      std::exchange(handle_, {}).destroy();
+    }
+  }
+
+private:
+  explicit Script(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename Owner_, typename Event_>
+struct CoroutineReact
+{
+  bool react(Event_ const& event) {
+    return static_cast<Owner_&>(*this).resume_with(event);
+  }
+};
+
+// State whose behavior is the coroutine `Script run()` of Derived_: it starts
+// on entry, suspends in `co_await receive<Event...>()` until dispatch() delivers
+// one of those events, and is destroyed on exit. Timeouts are events like any
+// other, awaited together with the expected reply. Base_ is the State/Region
+// the state would otherwise derive from.
+//
+//   struct Handshake : CoroutineState<Handshake, State, 256, Ack, Timeout> {
+//     Script run() { ...; auto reply = co_await receive<Ack, Timeout>(); ... }
+//   };
+//
+// States declaring their own react() must add `using CoroutineState::react;`.
+template <typename Derived_, typename Base_, std::size_t FrameSize_, typename ... Event_>
+struct CoroutineState : Base_, CoroutineReact<CoroutineState<Derived_, Base_, FrameSize_, Event_...>, Event_>..., CoroutineFrame
+{
+  using CoroutineReact<CoroutineState, Event_>::react...;
+
+  template <typename ... Awaited_>
+  auto receive() {
+    static_assert((accepts<Awaited_> && ...), "awaited events must be listed in CoroutineState");
+    struct Awaiter
+    {
+      CoroutineState& state;
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle) {
+        state.awaiting_ = handle;
+        state.awaited_ = (mask<Awaited_>() | ...);
+      }
+      auto await_resume() {
+        if constexpr(sizeof...(Awaited_) == 1) {
+          return std::get<Awaited_...>(state.received_);
+        }
+        else {
+          return visit([](auto const& event) -> std::variant<Awaited_...> {
+            if constexpr((std::is_same_v<std::decay_t<decltype(event)>, Awaited_> || ...)) {
+              return event;
+            }
+            return {};
+          }, state.received_);
+        }
+      }
+    };
+    return Awaiter{*this};
+  }
+
+  void on_entry() {
+    this->frame_storage_ = frame_;
+    this->frame_capacity_ = FrameSize_;
+    script_ = static_cast<Derived_&>(*this).run();
+  }
+
+  void on_exit() {
+    awaiting_ = {};
+    awaited_ = 0;
+    script_.reset();
+  }
+
+  // internal
+  template <typename Awaited_>
+  static constexpr bool accepts = (std::is_same_v<Awaited_, Event_> || ...);
+
+  template <typename Awaited_>
+  static constexpr unsigned mask() {
+    return 1u << index_v<Awaited_, std::tuple<Event_...>>;
+  }
+
+  template <typename Received_>
+  bool resume_with(Received_ const& event) {
+    if (!(awaited_ & mask<Received_>())) {
+      return false;
+    }
+    received_ = event;
+    awaited_ = 0;
+    std::exchange(awaiting_, {}).resume();
+    return true;
+  }
+
+  static_assert(sizeof...(Event_) <= 32, "too many awaited event types");
+  alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) std::byte frame_[FrameSize_];
+  Script script_;
+  std::coroutine_handle<> awaiting_;
+  unsigned awaited_ = 0;
+  std::variant<Event_...> received_;
+};
+
+}
+
+#endif
@@ -0,0 +1,5 @@
+#include "machine.hpp"
+
+void close_door(metahsm::StateMachine<DoorTopState>& door) {
+  door.dispatch<Close>();
+}
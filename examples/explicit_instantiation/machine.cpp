@@ -0,0 +1,7 @@
+#include "machine.hpp"
+
+void DoorTopState::Opened::react(Close) { transition<Closed>(); }
+void DoorTopState::Closed::react(Open) { transition<Opened>(); }
+void DoorTopState::Closed::react(Lock) { transition<Locked>(); }
+
+METAHSM_INSTANTIATE_MACHINE(DoorTopState, Open, Close, Lock)
@@ -0,0 +1,29 @@
+// Machine shared by several translation units. The instantiation of
+// StateMachine<DoorTopState> lives in machine.cpp; the other translation
+// units only see the extern template declarations.
+#pragma once
+#include "instantiate.hpp"
+
+struct Open {};
+struct Close {};
+struct Lock {};
+
+struct DoorTopState : metahsm::State<DoorTopState>
+{
+  struct Opened : State
+  {
+    void react(Close);
+  };
+  struct Closed : State
+  {
+    void react(Open);
+    void react(Lock);
+  };
+  struct Locked : State
+  {};
+  using SubStates = std::tuple<Opened, Closed, Locked>;
+};
+
+METAHSM_DECLARE_MACHINE(DoorTopState, Open, Close, Lock)
+
+void close_door(metahsm::StateMachine<DoorTopState>& door);
@@ -0,0 +1,11 @@
+#include <cassert>
+#include "machine.hpp"
+
+int main() {
+  metahsm::StateMachine<DoorTopState> door;
+  close_door(door);
+  assert(door.is_in_state<DoorTopState::Closed>());
+  door.dispatch<Lock>();
+  assert(door.is_in_state<DoorTopState::Locked>());
+  return 0;
+}
@@ -0,0 +1,45 @@
+// Footprint of metahsm in the embedded profile: no exceptions, no RTTI, no
+// tracing, and METAHSM_HOSTED=0. Built by the `footprint` target, which prints
+// the text (flash) and data/bss (RAM) sizes after linking, then runs it to
+// print the instance sizes.
+#include <cstddef>
+#include <cstdio>
+#include "lifecycle.hpp"
+
+#if defined(_GLIBCXX_IOSTREAM) || defined(_LIBCPP_IOSTREAM)
+#error "the embedded profile must not pull in <iostream>"
+#endif
+#if defined(_GLIBCXX_CHRONO) || defined(_LIBCPP_CHRONO) || defined(_GLIBCXX_ATOMIC) || defined(_LIBCPP_ATOMIC) \
+    || defined(_GLIBCXX_SPAN) || defined(_LIBCPP_SPAN)
+#error "the embedded profile must not pull in <chrono>, <atomic> or <span>"
+#endif
+
+// Redeclared as templates of another kind, so the build fails if wire.hpp,
+// resident_slot.hpp or inplace_function.hpp were included.
+namespace metahsm {
+template <int> struct WireStatus;
+template <int> struct ResidentSlot;
+template <int> struct InplaceFunction;
+}
+
+using namespace metahsm;
+
+extern const std::size_t sizeof_machines[] = {
+  sizeof(StateMachine<LifecycleTopState>),
+  sizeof(StateMachine<TLC3TopState>),
+};
+
+int main() {
+  std::printf("sizeof(StateMachine<LifecycleTopState>) %zu\nsizeof(StateMachine<TLC3TopState>) %zu\n", sizeof_machines[0], sizeof_machines[1]);
+  StateMachine<LifecycleTopState> lifecycle;
+  lifecycle.dispatch<Event<CONFIGURE>>();
+  lifecycle.dispatch<Event<ACTIVATE>>();
+  lifecycle.dispatch<Event<ACTIVATE>>();
+  lifecycle.dispatch<Event<CLEANUP>>();
+  lifecycle.dispatch<Event<DEACTIVATE>>();
+
+  StateMachine<TLC3TopState> tlc;
+  tlc.dispatch<Event<CONFIGURE>>();
+  tlc.dispatch<Event<CONFIGURE>>();
+  return lifecycle.is_in_state<LifecycleTopState::Inactive>() && tlc.is_in_state<TLC3TopState>() ? 0 : 1;
+}
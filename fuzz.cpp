@@ -0,0 +1,348 @@
+// Differential fuzzer: machines with random hierarchies, generated at compile
+// time from seeds, run random event sequences through StateMachine and through
+// the Interpreter built from describe<>(). After every step the configuration,
+// last/last_recursive of every state, the reaction result and the order of
+// on_entry()/on_exit() calls and transition actions must agree. The hierarchies
+// mix composite and orthogonal states; the transition table rows pick random
+// sources and targets, shallow and deep history, guards, actions and completion
+// events. Another engine is compared by adding an Engine adaptor to fuzz_machine().
+//
+//   fuzz [runs per machine] [steps per run] [first run seed]
+//
+// Rebuild with -DMETAHSM_FUZZ_SEED=<n> for other hierarchies and with
+// -DMETAHSM_FUZZ_MACHINES=<n> for more of them per build.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+#include "metahsm.hpp"
+#include "interpreter.hpp"
+
+#ifndef METAHSM_FUZZ_MACHINES
+#define METAHSM_FUZZ_MACHINES 8
+#endif
+#ifndef METAHSM_FUZZ_SEED
+#define METAHSM_FUZZ_SEED 0
+#endif
+
+using namespace metahsm;
+
+constexpr std::uint64_t mix(std::uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Log of the step in progress: on_entry() of state id logs id, on_exit()
+// 64 + id and the action of row i 128 + i.
+std::vector<std::uint16_t> fuzz_log;
+constexpr std::uint16_t exit_tag = 64;
+constexpr std::uint16_t action_tag = 128;
+
+template <std::size_t I_>
+struct FuzzEvent
+{
+  std::uint32_t bits;
+};
+
+constexpr std::size_t event_count = 4;
+using FuzzEvents = std::tuple<FuzzEvent<0>, FuzzEvent<1>, FuzzEvent<2>, FuzzEvent<3>>;
+
+// Guard of row Row_: a bit of the event, so that both engines agree however
+// often they evaluate it. Completion carries no bits.
+template <std::size_t Row_>
+struct FuzzGuard
+{
+  template <typename State_, typename Event_>
+  bool operator()(State_&, Event_ const& event) const {
+    if constexpr(std::is_same_v<Event_, Completion>) {
+      return false;
+    }
+    else {
+      return (event.bits >> (Row_ % 32)) & 1;
+    }
+  }
+};
+
+template <std::size_t Row_>
+struct FuzzAction
+{
+  template <typename State_, typename Event_>
+  void operator()(State_&, Event_ const&) const {
+    fuzz_log.push_back(action_tag + Row_);
+  }
+};
+
+template <typename Self_, typename TopState_>
+struct Logged : State<TopState_>
+{
+  void on_entry() { fuzz_log.push_back(state_id_v<Self_>); }
+  void on_exit() { fuzz_log.push_back(exit_tag + state_id_v<Self_>); }
+};
+
+enum class Kind
+{
+  simple,
+  composite,
+  orthogonal
+};
+
+constexpr Kind kind_of(std::uint64_t seed, std::size_t depth) {
+  const std::uint64_t r = mix(seed) % 8;
+  return depth == 0 || r < 3 ? Kind::simple : depth >= 2 && r >= 6 ? Kind::orthogonal : Kind::composite;
+}
+
+// Two children each, two or three below the top state: up to 46 states, deep
+// enough for deep history to differ from shallow history.
+constexpr std::size_t children_of(std::uint64_t seed, bool top = false) {
+  return top ? 2 + mix(seed ^ 0x5a5a) % 2 : 2;
+}
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_, Kind Kind_ = kind_of(Seed_, Depth_)>
+struct Node;
+
+// Nodes at Depth_ from seeds derived from Seed_; regions are composite.
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_, bool Regions_, typename Index_>
+struct nodes;
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_, bool Regions_, std::size_t ... I_>
+struct nodes<TopState_, Seed_, Depth_, Regions_, std::index_sequence<I_...>>
+{
+  using type = std::tuple<Node<TopState_, mix(Seed_ + I_ + 1), Depth_,
+      Regions_ ? Kind::composite : kind_of(mix(Seed_ + I_ + 1), Depth_)>...>;
+};
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_, bool Top_ = false>
+using children_t = typename nodes<TopState_, Seed_, Depth_ - 1, false, std::make_index_sequence<children_of(Seed_, Top_)>>::type;
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_>
+struct Node<TopState_, Seed_, Depth_, Kind::simple> : Logged<Node<TopState_, Seed_, Depth_, Kind::simple>, TopState_>
+{ };
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_>
+struct Node<TopState_, Seed_, Depth_, Kind::composite> : Logged<Node<TopState_, Seed_, Depth_, Kind::composite>, TopState_>
+{
+  using SubStates = children_t<TopState_, Seed_, Depth_>;
+};
+
+template <typename TopState_, std::uint64_t Seed_, std::size_t Depth_>
+struct Node<TopState_, Seed_, Depth_, Kind::orthogonal> : Logged<Node<TopState_, Seed_, Depth_, Kind::orthogonal>, TopState_>
+{
+  using Regions = typename nodes<TopState_, Seed_, Depth_ - 1, true, std::make_index_sequence<2>>::type;
+};
+
+// The states below the top state, spelled out so the top state can name them.
+template <typename State_, typename = void>
+struct tree { using type = std::tuple<State_>; };
+
+template <typename ... State_>
+struct trees { using type = tuple_join_t<typename tree<State_>::type...>; };
+
+template <typename ... State_>
+struct trees<std::tuple<State_...>> : trees<State_...> {};
+
+template <typename State_>
+struct tree<State_, std::void_t<typename State_::SubStates>>
+{
+  using type = tuple_join_t<State_, typename trees<typename State_::SubStates>::type>;
+};
+
+template <typename State_>
+struct tree<State_, std::void_t<typename State_::Regions>>
+{
+  using type = tuple_join_t<State_, typename trees<typename State_::Regions>::type>;
+};
+
+template <typename TopState_, typename States_, std::uint64_t Seed_, std::size_t Row_>
+struct row
+{
+  static constexpr std::uint64_t r = mix(Seed_ * 31 + Row_);
+  static constexpr std::size_t n = std::tuple_size_v<States_>;
+  using From = std::conditional_t<r % 8 == 0, TopState_, std::tuple_element_t<(r >> 3) % n, States_>>;
+  using Target = std::tuple_element_t<(r >> 11) % n, States_>;
+  using To = std::conditional_t<(r >> 19) % 4 == 2, typename History<Target>::Shallow,
+      std::conditional_t<(r >> 19) % 4 == 3, typename History<Target>::Deep, Target>>;
+  using Event = std::conditional_t<(r >> 23) % 9 == 8, Completion, std::tuple_element_t<(r >> 23) % 9 % event_count, FuzzEvents>>;
+  using Guard = std::conditional_t<(r >> 27) % 3 == 0, FuzzGuard<Row_>, void>;
+  using Action = std::conditional_t<(r >> 30) % 2 == 0, FuzzAction<Row_>, void>;
+  using type = Transition<From, Event, To, Guard, Action>;
+};
+
+template <typename TopState_, typename States_, std::uint64_t Seed_, typename Index_>
+struct rows;
+
+template <typename TopState_, typename States_, std::uint64_t Seed_, std::size_t ... Row_>
+struct rows<TopState_, States_, Seed_, std::index_sequence<Row_...>>
+{
+  using type = std::tuple<typename row<TopState_, States_, Seed_, Row_>::type...>;
+};
+
+template <std::uint64_t Seed_>
+struct FuzzTopState : Logged<FuzzTopState<Seed_>, FuzzTopState<Seed_>>
+{
+  using SubStates = children_t<FuzzTopState, Seed_, 4, true>;
+  using Declared = typename trees<SubStates>::type;
+  using Transitions = typename rows<FuzzTopState, Declared, Seed_, std::make_index_sequence<2 * std::tuple_size_v<Declared> + 2>>::type;
+};
+
+// What the engines are compared on after each step.
+struct Observation
+{
+  bool reacted = false;
+  std::uint64_t active = 0;
+  std::vector<std::uint64_t> last;
+  std::vector<std::uint64_t> last_recursive;
+  std::vector<std::uint16_t> log;
+
+  bool operator==(Observation const& other) const {
+    return reacted == other.reacted && active == other.active && last == other.last
+        && last_recursive == other.last_recursive && log == other.log;
+  }
+};
+
+// Engine adaptors: the constructor starts the machine, whose entries are the
+// log of the first observation.
+template <typename TopState_>
+class CompiledEngine
+{
+public:
+  CompiledEngine() {
+    fuzz_log.clear();
+    machine_ = std::make_unique<StateMachine<TopState_>>();
+  }
+
+  void step(std::size_t event, std::uint32_t bits, Observation& observation) {
+    fuzz_log.clear();
+    observation.reacted = dispatch(event, bits, std::make_index_sequence<event_count>());
+    observe(observation);
+  }
+
+  void observe(Observation& observation) {
+    observation.active = machine_->active_states();
+    observation.last.resize(states);
+    observation.last_recursive.resize(states);
+    observe(observation, type_identity<all_states_t<TopState_>>{});
+    observation.log = fuzz_log;
+  }
+
+private:
+  static constexpr std::size_t states = std::tuple_size_v<all_states_t<TopState_>>;
+
+  template <std::size_t ... I_>
+  bool dispatch(std::size_t event, std::uint32_t bits, std::index_sequence<I_...>) {
+    bool reacted = false;
+    ((event == I_ ? (reacted = machine_->dispatch(FuzzEvent<I_>{bits})) : false), ...);
+    return reacted;
+  }
+
+  template <typename ... State_>
+  void observe(Observation& observation, type_identity<std::tuple<State_...>>) {
+    ((observation.last[state_id_v<State_>] = machine_->template get_state<State_>().last,
+      observation.last_recursive[state_id_v<State_>] = machine_->template get_state<State_>().last_recursive), ...);
+  }
+
+  std::unique_ptr<StateMachine<TopState_>> machine_;
+};
+
+class InterpretedEngine
+{
+public:
+  explicit InterpretedEngine(MachineDescription const& description)
+  : interpreter_{description, {this,
+      [](void*, std::uint16_t row, const void* event) {
+        return event && ((*static_cast<const std::uint32_t*>(event) >> (row % 32)) & 1);
+      },
+      [](void* engine, std::uint16_t row, const void*) {
+        static_cast<InterpretedEngine*>(engine)->log_.push_back(action_tag + row);
+      },
+      [](void* engine, std::uint16_t state) {
+        static_cast<InterpretedEngine*>(engine)->log_.push_back(state);
+      },
+      [](void* engine, std::uint16_t state) {
+        static_cast<InterpretedEngine*>(engine)->log_.push_back(exit_tag + state);
+      }}}
+  {}
+
+  void step(std::size_t event, std::uint32_t bits, Observation& observation) {
+    log_.clear();
+    observation.reacted = interpreter_.dispatch(static_cast<std::uint16_t>(event), &bits);
+    observe(observation);
+  }
+
+  void observe(Observation& observation) {
+    const std::size_t states = interpreter_.size();
+    observation.active = interpreter_.active_states();
+    observation.last.resize(states);
+    observation.last_recursive.resize(states);
+    for (std::uint16_t id = 0; id < states; id++) {
+      observation.last[id] = interpreter_.last(id);
+      observation.last_recursive[id] = interpreter_.last_recursive(id);
+    }
+    observation.log = log_;
+  }
+
+private:
+  std::vector<std::uint16_t> log_;
+  Interpreter interpreter_;
+};
+
+void print(char const* engine, Observation const& observation) {
+  std::printf("  %-12s reacted %d, active %016llx, log", engine, observation.reacted,
+      static_cast<unsigned long long>(observation.active));
+  for (auto entry : observation.log) {
+    std::printf(" %u", entry);
+  }
+  std::printf("\n  %-12s last/last_recursive", "");
+  for (std::size_t id = 0; id < observation.last.size(); id++) {
+    std::printf(" %llx/%llx", static_cast<unsigned long long>(observation.last[id]),
+        static_cast<unsigned long long>(observation.last_recursive[id]));
+  }
+  std::printf("\n");
+}
+
+template <std::uint64_t Seed_>
+bool fuzz_machine(std::uint64_t run_seed, std::size_t steps) {
+  using Top = FuzzTopState<Seed_>;
+  CompiledEngine<Top> compiled;
+  InterpretedEngine interpreted{describe<Top, FuzzEvents>()};
+  Observation expected, actual;
+  compiled.observe(expected);
+  interpreted.observe(actual);
+  std::mt19937_64 random{run_seed};
+  for (std::size_t step = 0; ; step++) {
+    if (!(expected == actual)) {
+      std::printf("machine %llu, run %llu: engines diverge %s step %zu\n", static_cast<unsigned long long>(Seed_),
+          static_cast<unsigned long long>(run_seed), step ? "after" : "at start,", step);
+      print("StateMachine", expected);
+      print("Interpreter", actual);
+      return false;
+    }
+    if (step == steps) {
+      return true;
+    }
+    const std::size_t event = random() % event_count;
+    const std::uint32_t bits = static_cast<std::uint32_t>(random());
+    compiled.step(event, bits, expected);
+    interpreted.step(event, bits, actual);
+  }
+}
+
+template <std::uint64_t ... Index_>
+bool fuzz_machines(std::uint64_t first_run, std::size_t runs, std::size_t steps, std::integer_sequence<std::uint64_t, Index_...>) {
+  bool agree = true;
+  for (std::uint64_t run = first_run; run < first_run + runs; run++) {
+    agree = ((fuzz_machine<METAHSM_FUZZ_SEED + Index_>(run, steps) && ...)) && agree;
+  }
+  std::printf("%zu machines, %zu runs of %zu steps each: %s\n", sizeof...(Index_), runs, steps, agree ? "engines agree" : "engines diverge");
+  return agree;
+}
+
+int main(int argc, char* argv[]) {
+  const std::size_t runs = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4;
+  const std::size_t steps = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500;
+  const std::uint64_t first_run = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+  return fuzz_machines(first_run, runs, steps, std::make_integer_sequence<std::uint64_t, METAHSM_FUZZ_MACHINES>()) ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+
+#include "metahsm.hpp"
+#include "bus.hpp"
+#include "spsc.hpp"
+
+namespace metahsm {
+
+// Trivially copyable value kept in relaxed atomic words, so that a seqlock
+// reader racing with the writer copies it without a data race.
+template <typename T_>
+class AtomicCopy
+{
+public:
+  static_assert(std::is_trivially_copyable_v<T_>, "coalesced and drop-oldest events must be trivially copyable");
+
+  void store(T_ const& value) {
+    std::uint64_t words[N]{};
+    std::memcpy(words, &value, sizeof(T_));
+    for (std::size_t i = 0; i < N; i++) {
+      words_[i].store(words[i], std::memory_order_relaxed);
+    }
+  }
+
+  T_ load() const {
+    std::uint64_t words[N];
+    for (std::size_t i = 0; i < N; i++) {
+      words[i] = words_[i].load(std::memory_order_relaxed);
+    }
+    // memcpy() implicitly creates the trivially copyable value in storage,
+    // which spares T_ a default constructor
+    alignas(T_) unsigned char storage[sizeof(T_)];
+    std::memcpy(storage, words, sizeof(T_));
+    return *std::launder(reinterpret_cast<T_*>(storage));
+  }
+
+private:
+  static constexpr std::size_t N = (sizeof(T_) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+  std::array<std::atomic<std::uint64_t>, N> words_{};
+};
+
+// Single slot holding the latest value stored, under a seqlock. store() is
+// wait-free; take() returns each stored value at most once and tells how many
+// were overwritten before it got to them, or nothing if none is new.
+template <typename Event_>
+class LatestSlot
+{
+public:
+  void store(Event_ const& event) {
+    const std::uint64_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    value_.store(event);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  std::optional<Event_> take(std::size_t& overwritten) {
+    std::optional<Event_> event;
+    std::uint64_t begin, end;
+    do {
+      begin = sequence_.load(std::memory_order_acquire);
+      if (begin == taken_) {
+        return std::nullopt;
+      }
+      event.emplace(value_.load());
+      std::atomic_thread_fence(std::memory_order_acquire);
+      end = sequence_.load(std::memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    overwritten = (begin - taken_) / 2 - 1;
+    taken_ = begin;
+    return event;
+  }
+
+private:
+  alignas(cache_line_size) std::atomic<std::uint64_t> sequence_{0};
+  AtomicCopy<Event_> value_;
+  alignas(cache_line_size) std::uint64_t taken_{0};
+};
+
+// Bounded single-producer/single-consumer ring that never rejects: when full,
+// push() claims the oldest slot by advancing head with a CAS, racing the
+// consumer for it. Each slot carries the position it was written for, so a
+// consumer that lost the race notices and retries instead of dispatching an
+// overwritten value.
+template <typename Event_, std::size_t Capacity_>
+class SheddingRing
+{
+public:
+  static_assert(Capacity_ > 0 && (Capacity_ & (Capacity_ - 1)) == 0, "capacity must be a power of two");
+
+  // Returns whether the oldest entry was shed to make room.
+  bool push(Event_ const& event) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    std::size_t head = head_.load(std::memory_order_acquire);
+    bool shed = false;
+    if (tail - head == Capacity_) {
+      // fails only if the consumer took the oldest entry first
+      shed = head_.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire);
+    }
+    Slot& slot = slots_[tail & (Capacity_ - 1)];
+    slot.position.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.value.store(event);
+    slot.position.store(tail + 1, std::memory_order_release);
+    tail_.store(tail + 1, std::memory_order_release);
+    return shed;
+  }
+
+  std::optional<Event_> pop() {
+    std::optional<Event_> event;
+    std::size_t head = head_.load(std::memory_order_acquire);
+    while (head != tail_.load(std::memory_order_acquire)) {
+      Slot& slot = slots_[head & (Capacity_ - 1)];
+      const std::size_t position = slot.position.load(std::memory_order_acquire);
+      event.emplace(slot.value.load());
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (position != head + 1 || slot.position.load(std::memory_order_relaxed) != position) {
+        head = head_.load(std::memory_order_acquire);
+        continue;
+      }
+      if (head_.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return event;
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<std::size_t> position{0};
+    AtomicCopy<Event_> value;
+  };
+
+  alignas(cache_line_size) std::atomic<std::size_t> head_{0};
+  alignas(cache_line_size) std::atomic<std::size_t> tail_{0};
+  alignas(cache_line_size) std::array<Slot, Capacity_> slots_{};
+};
+
+// Inbound queue of one machine from one producer thread, applying the
+// QueuePolicy each event type of mailbox_t<TopState_> declares (see
+// type_traits.hpp). fifo and drop_unhandled events share one SPSC ring and
+// keep their order; every drop_oldest type has a ring of its own and every
+// coalesce_latest type a single slot. drain() delivers the shared ring first,
+// then the drop_oldest rings, then the latest coalesced values, so order is
+// kept within each of these, not across them. Nothing locks: shedding is
+// decided by the producer with a CAS or a seqlock write, or by the consumer
+// from the handler mask of the event and the active states.
+template <typename TopState_, std::size_t Capacity_>
+class Inbox
+{
+public:
+  using Event = mailbox_t<TopState_>;
+
+  // Called from the producer thread only. Returns false if the event was
+  // rejected because the shared ring was full.
+  template <typename Event_>
+  bool push(Event_ const& event) {
+    auto& lane = std::get<Lane<Event_>>(lanes_);
+    if constexpr (queue_policy_v<Event_> == QueuePolicy::coalesce_latest) {
+      lane.slot.store(event);
+      return true;
+    }
+    else if constexpr (queue_policy_v<Event_> == QueuePolicy::drop_oldest) {
+      if (lane.ring.push(event)) {
+        count(lane.shed, 1);
+      }
+      return true;
+    }
+    else {
+      return queue_.push(Event{event});
+    }
+  }
+
+  // Called from the thread that owns state_machine. Dispatches up to max_batch
+  // events from each lane; returns the number of events dispatched.
+  std::size_t drain(StateMachine<TopState_>& state_machine, std::size_t max_batch = Capacity_) {
+    std::size_t dropped = 0;
+    std::size_t dispatched = queue_.drain([&](Event const& envelope) {
+      visit([&](auto const& event) {
+        using Event_ = std::remove_cv_t<std::remove_reference_t<decltype(event)>>;
+        if constexpr (queue_policy_v<Event_> == QueuePolicy::drop_unhandled) {
+          if (!state_machine.template handles<Event_>()) {
+            count(std::get<Lane<Event_>>(lanes_).shed, 1);
+            dropped++;
+            return;
+          }
+        }
+        state_machine.template dispatch<Event_>(event);
+      }, envelope);
+    }, max_batch) - dropped;
+    std::apply([&](auto & ... lane) {
+      ((dispatched += drain_lane(state_machine, lane, max_batch)), ...);
+    }, lanes_);
+    return dispatched;
+  }
+
+  // Events of type Event_ shed by its policy so far: coalesced into a later
+  // value, dropped as unhandled, or dropped as the oldest of a full ring.
+  template <typename Event_>
+  std::size_t shed() const {
+    return std::get<Lane<Event_>>(lanes_).shed.load(std::memory_order_relaxed);
+  }
+
+  // fifo and drop_unhandled events rejected because the shared ring was full.
+  std::size_t rejected() const {
+    return queue_.rejected();
+  }
+
+private:
+  template <typename Event_, QueuePolicy = queue_policy_v<Event_>>
+  struct Lane
+  {
+    std::atomic<std::size_t> shed{0};
+  };
+
+  template <typename Event_>
+  struct Lane<Event_, QueuePolicy::coalesce_latest>
+  {
+    std::atomic<std::size_t> shed{0};
+    LatestSlot<Event_> slot;
+  };
+
+  template <typename Event_>
+  struct Lane<Event_, QueuePolicy::drop_oldest>
+  {
+    std::atomic<std::size_t> shed{0};
+    SheddingRing<Event_, Capacity_> ring;
+  };
+
+  template <typename Variant_>
+  struct Lanes;
+
+  template <typename ... Event_>
+  struct Lanes<std::variant<Event_...>>
+  {
+    using type = std::tuple<Lane<Event_>...>;
+  };
+
+  // each counter has a single writer
+  static void count(std::atomic<std::size_t>& counter, std::size_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  template <typename Event_, QueuePolicy Policy_>
+  static std::size_t drain_lane(StateMachine<TopState_>& state_machine, Lane<Event_, Policy_>& lane, std::size_t max_batch) {
+    std::size_t dispatched = 0;
+    if constexpr (Policy_ == QueuePolicy::coalesce_latest) {
+      std::size_t overwritten = 0;
+      if (std::optional<Event_> event = lane.slot.take(overwritten)) {
+        count(lane.shed, overwritten);
+        state_machine.template dispatch<Event_>(*event);
+        dispatched++;
+      }
+    }
+    else if constexpr (Policy_ == QueuePolicy::drop_oldest) {
+      while (dispatched < max_batch) {
+        std::optional<Event_> event = lane.ring.pop();
+        if (!event) {
+          break;
+        }
+        state_machine.template dispatch<Event_>(*event);
+        dispatched++;
+      }
+    }
+    return dispatched;
+  }
+
+  SpscChannel<Event, Capacity_> queue_;
+  typename Lanes<Event>::type lanes_;
+};
+
+}
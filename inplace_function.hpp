@@ -0,0 +1,113 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bytes of in-place storage for transition actions and deferred events.
+#ifndef METAHSM_ACTION_CAPACITY
+#define METAHSM_ACTION_CAPACITY 64
+#endif
+
+namespace metahsm {
+
+// Move-only type-erased callable kept in a fixed buffer, never on the heap.
+// Callables that do not fit are rejected at compile time.
+template <typename Signature_, std::size_t Capacity_ = METAHSM_ACTION_CAPACITY>
+class InplaceFunction;
+
+template <typename Result_, typename ... Arg_, std::size_t Capacity_>
+class InplaceFunction<Result_(Arg_...), Capacity_>
+{
+public:
+  template <typename Callable_>
+  static constexpr bool fits = sizeof(Callable_) <= Capacity_ && alignof(Callable_) <= alignof(std::max_align_t);
+
+  InplaceFunction() = default;
+
+  template <typename Callable_, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Callable_>, InplaceFunction>>>
+  InplaceFunction(Callable_ && callable) {
+    using Stored = std::decay_t<Callable_>;
+    static_assert(fits<Stored>, "callable too large for in-place storage, raise METAHSM_ACTION_CAPACITY");
+    ::new (static_cast<void*>(storage_)) Stored(std::forward<Callable_>(callable));
+    invoke_ = [](void* storage, Arg_ ... args) -> Result_ {
+      return (*static_cast<Stored*>(storage))(std::forward<Arg_>(args)...);
+    };
+    relocate_ = [](void* target, void* source) {
+      if(target) {
+        ::new (target) Stored(std::move(*static_cast<Stored*>(source)));
+      }
+      static_cast<Stored*>(source)->~Stored();
+    };
+  }
+
+  InplaceFunction(InplaceFunction && other) noexcept {
+    take(other);
+  }
+
+  InplaceFunction& operator=(InplaceFunction && other) noexcept {
+    if(this != &other) {
+      reset();
+      take(other);
+    }
+    return *this;
+  }
+
+  InplaceFunction(InplaceFunction const&) = delete;
+  InplaceFunction& operator=(InplaceFunction const&) = delete;
+
+  ~InplaceFunction() {
+    reset();
+  }
+
+  explicit operator bool() const {
+    return invoke_ != nullptr;
+  }
+
+  Result_ operator()(Arg_ ... args) {
+    return invoke_(storage_, std::forward<Arg_>(args)...);
+  }
+
+  void reset() {
+    if(relocate_) {
+      relocate_(nullptr, storage_);
+    }
+    invoke_ = nullptr;
+    relocate_ = nullptr;
+  }
+
+private:
+  void take(InplaceFunction & other) {
+    if(other.relocate_) {
+      other.relocate_(storage_, other.storage_);
+    }
+    invoke_ = std::exchange(other.invoke_, nullptr);
+    relocate_ = std::exchange(other.relocate_, nullptr);
+  }
+
+  // none_ keeps empty functions constant-initializable
+  union
+  {
+    std::byte none_{};
+    alignas(std::max_align_t) std::byte storage_[Capacity_];
+  };
+  Result_ (*invoke_)(void*, Arg_...) = nullptr;
+  void (*relocate_)(void*, void*) = nullptr;
+};
+
+}
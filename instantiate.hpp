@@ -0,0 +1,77 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "metahsm.hpp"
+
+// Explicit instantiation mode for large machines. In the header declaring the
+// machine:
+//
+//   METAHSM_DECLARE_MACHINE(MyTopState, Event1, Event2)
+//
+// and in exactly one translation unit:
+//
+//   METAHSM_INSTANTIATE_MACHINE(MyTopState, Event1, Event2)
+//
+// The other translation units then reuse the StateMachine<MyTopState> members,
+// its dispatch<Event>() set and the wrapper code they pull in, instead of
+// instantiating them again. Both macros must be used at global scope, with up
+// to 16 event types. Defining METAHSM_HEADER_ONLY turns them into no-ops.
+
+#define METAHSM_EXPAND_(...) __VA_ARGS__
+#define METAHSM_FOR_EACH_1_(M, T, E) M(T, E)
+#define METAHSM_FOR_EACH_2_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_1_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_3_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_2_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_4_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_3_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_5_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_4_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_6_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_5_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_7_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_6_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_8_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_7_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_9_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_8_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_10_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_9_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_11_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_10_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_12_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_11_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_13_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_12_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_14_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_13_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_15_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_14_(M, T, __VA_ARGS__))
+#define METAHSM_FOR_EACH_16_(M, T, E, ...) M(T, E) METAHSM_EXPAND_(METAHSM_FOR_EACH_15_(M, T, __VA_ARGS__))
+#define METAHSM_SELECT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+#define METAHSM_FOR_EACH_(M, T, ...) METAHSM_EXPAND_(METAHSM_SELECT_(__VA_ARGS__, \
+    METAHSM_FOR_EACH_16_, METAHSM_FOR_EACH_15_, METAHSM_FOR_EACH_14_, METAHSM_FOR_EACH_13_, \
+    METAHSM_FOR_EACH_12_, METAHSM_FOR_EACH_11_, METAHSM_FOR_EACH_10_, METAHSM_FOR_EACH_9_, \
+    METAHSM_FOR_EACH_8_, METAHSM_FOR_EACH_7_, METAHSM_FOR_EACH_6_, METAHSM_FOR_EACH_5_, \
+    METAHSM_FOR_EACH_4_, METAHSM_FOR_EACH_3_, METAHSM_FOR_EACH_2_, METAHSM_FOR_EACH_1_)(M, T, __VA_ARGS__))
+
+#define METAHSM_EXTERN_DISPATCH_(TopState, Event) \
+    extern template bool metahsm::StateMachine<TopState>::dispatch<Event>(const Event&);
+#define METAHSM_INSTANTIATE_DISPATCH_(TopState, Event) \
+    template bool metahsm::StateMachine<TopState>::dispatch<Event>(const Event&);
+
+#if defined(METAHSM_HEADER_ONLY)
+
+#define METAHSM_DECLARE_MACHINE(TopState, ...)
+#define METAHSM_INSTANTIATE_MACHINE(TopState, ...)
+
+#else
+
+#define METAHSM_DECLARE_MACHINE(TopState, ...) \
+    extern template class metahsm::StateMachine<TopState>; \
+    METAHSM_FOR_EACH_(METAHSM_EXTERN_DISPATCH_, TopState, __VA_ARGS__)
+
+#define METAHSM_INSTANTIATE_MACHINE(TopState, ...) \
+    template class metahsm::StateMachine<TopState>; \
+    METAHSM_FOR_EACH_(METAHSM_INSTANTIATE_DISPATCH_, TopState, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,640 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "metahsm.hpp"
+
+namespace metahsm {
+
+// Runtime backend for machines that are only known as data. An Interpreter
+// runs a MachineDescription with the semantics of StateMachine: composite and
+// orthogonal states, shallow and deep history, the same is_valid() check, exit
+// then transition action then entry, and completion steps. Reactions are the
+// rows of a transition table, like the Transitions of a top state.
+
+enum class StateKind : std::uint8_t
+{
+  SIMPLE,
+  COMPOSITE,
+  ORTHOGONAL
+};
+
+enum class HistoryKind : std::uint8_t
+{
+  NONE,
+  SHALLOW,
+  DEEP
+};
+
+inline constexpr std::uint16_t no_id = 0xffff;
+// Event id of the completion event, see Completion.
+inline constexpr std::uint16_t completion_event = 0xfffe;
+
+struct StateRecord
+{
+  std::uint16_t parent = no_id;
+  StateKind kind = StateKind::SIMPLE;
+  std::uint16_t initial = no_id;
+  std::uint16_t entry = no_id;
+  std::uint16_t exit = no_id;
+};
+
+// A row without target (to == no_id) only runs its action.
+struct TransitionRecord
+{
+  std::uint16_t from;
+  std::uint16_t event;
+  std::uint16_t to = no_id;
+  HistoryKind history = HistoryKind::NONE;
+  std::uint16_t guard = no_id;
+  std::uint16_t action = no_id;
+};
+
+// States are numbered like all_states_t: the top state is 0, every parent has
+// a lower id than its children, and the children of a state have consecutive
+// ids in their order of declaration. initial is the initial sub state of a
+// composite state. entry, exit, guard and action are handler ids, each kind
+// in its own id space, see InterpreterHandlers.
+//
+// Binary form, little endian:
+//   header:     "MHSM", u8 version (1), u8 max_completion_steps, u16 states, u16 transitions
+//   state:      u16 parent, u8 kind, u16 initial, u16 entry, u16 exit
+//   transition: u16 from, u16 event, u16 to, u8 history, u16 guard, u16 action
+struct MachineDescription
+{
+  static constexpr std::uint8_t version = 1;
+  static constexpr std::size_t header_size = 10;
+  static constexpr std::size_t state_size = 9;
+  static constexpr std::size_t transition_size = 11;
+
+  std::vector<StateRecord> states;
+  std::vector<TransitionRecord> transitions;
+  std::uint8_t max_completion_steps = 8;
+
+  bool valid() const {
+    const std::size_t n = states.size();
+    if (n == 0 || n > 64 || states[0].parent != no_id || transitions.size() >= no_id) {
+      return false;
+    }
+    std::vector<std::uint16_t> last_child(n, no_id);
+    std::vector<std::uint16_t> child_count(n, 0);
+    for (std::size_t i = 1; i < n; i++) {
+      const std::uint16_t parent = states[i].parent;
+      if (parent >= i || states[parent].kind == StateKind::SIMPLE) {
+        return false;
+      }
+      if (last_child[parent] != no_id && last_child[parent] != i - 1) {
+        return false;
+      }
+      last_child[parent] = static_cast<std::uint16_t>(i);
+      child_count[parent]++;
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      if (states[i].kind != StateKind::SIMPLE && child_count[i] == 0) {
+        return false;
+      }
+      if (states[i].kind == StateKind::COMPOSITE
+          && (states[i].initial >= n || states[i].initial == 0 || states[states[i].initial].parent != i)) {
+        return false;
+      }
+    }
+    for (auto const& row : transitions) {
+      if (row.from >= n || (row.to != no_id && row.to >= n) || (row.to == no_id && row.history != HistoryKind::NONE)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<std::byte> encode() const {
+    std::vector<std::byte> data;
+    data.reserve(header_size + states.size() * state_size + transitions.size() * transition_size);
+    for (char c : {'M', 'H', 'S', 'M'}) {
+      put8(data, static_cast<std::uint8_t>(c));
+    }
+    put8(data, version);
+    put8(data, max_completion_steps);
+    put16(data, static_cast<std::uint16_t>(states.size()));
+    put16(data, static_cast<std::uint16_t>(transitions.size()));
+    for (auto const& state : states) {
+      put16(data, state.parent);
+      put8(data, static_cast<std::uint8_t>(state.kind));
+      put16(data, state.initial);
+      put16(data, state.entry);
+      put16(data, state.exit);
+    }
+    for (auto const& row : transitions) {
+      put16(data, row.from);
+      put16(data, row.event);
+      put16(data, row.to);
+      put8(data, static_cast<std::uint8_t>(row.history));
+      put16(data, row.guard);
+      put16(data, row.action);
+    }
+    return data;
+  }
+
+  // Returns false if data is not a valid description of this version.
+  static bool decode(const std::byte* data, std::size_t size, MachineDescription& description) {
+    if (size < header_size || get8(data) != 'M' || get8(data + 1) != 'H' || get8(data + 2) != 'S' || get8(data + 3) != 'M'
+        || get8(data + 4) != version) {
+      return false;
+    }
+    const std::size_t state_count = get16(data + 6);
+    const std::size_t transition_count = get16(data + 8);
+    if (size != header_size + state_count * state_size + transition_count * transition_size) {
+      return false;
+    }
+    MachineDescription result;
+    result.max_completion_steps = get8(data + 5);
+    result.states.resize(state_count);
+    result.transitions.resize(transition_count);
+    const std::byte* p = data + header_size;
+    for (auto& state : result.states) {
+      if (get8(p + 2) > static_cast<std::uint8_t>(StateKind::ORTHOGONAL)) {
+        return false;
+      }
+      state = {get16(p), static_cast<StateKind>(get8(p + 2)), get16(p + 3), get16(p + 5), get16(p + 7)};
+      p += state_size;
+    }
+    for (auto& row : result.transitions) {
+      if (get8(p + 6) > static_cast<std::uint8_t>(HistoryKind::DEEP)) {
+        return false;
+      }
+      row = {get16(p), get16(p + 2), get16(p + 4), static_cast<HistoryKind>(get8(p + 6)), get16(p + 7), get16(p + 9)};
+      p += transition_size;
+    }
+    if (!result.valid()) {
+      return false;
+    }
+    description = std::move(result);
+    return true;
+  }
+
+private:
+  static void put8(std::vector<std::byte>& data, std::uint8_t value) {
+    data.push_back(static_cast<std::byte>(value));
+  }
+
+  static void put16(std::vector<std::byte>& data, std::uint16_t value) {
+    put8(data, static_cast<std::uint8_t>(value));
+    put8(data, static_cast<std::uint8_t>(value >> 8));
+  }
+
+  static std::uint8_t get8(const std::byte* p) {
+    return static_cast<std::uint8_t>(*p);
+  }
+
+  static std::uint16_t get16(const std::byte* p) {
+    return static_cast<std::uint16_t>(get8(p) | (get8(p + 1) << 8));
+  }
+};
+
+// Code run by an Interpreter, selected by handler id. Each callback has its own
+// id space, so entry, exit, guard and action handlers may share ids. event is
+// the payload given to dispatch(), nullptr for completion steps. Without a
+// callback, the handlers of its kind do nothing, and guards reject.
+struct InterpreterHandlers
+{
+  void* context = nullptr;
+  bool (*guard)(void* context, std::uint16_t id, const void* event) = nullptr;
+  void (*action)(void* context, std::uint16_t id, const void* event) = nullptr;
+  void (*entry)(void* context, std::uint16_t id) = nullptr;
+  void (*exit)(void* context, std::uint16_t id) = nullptr;
+};
+
+class Interpreter
+{
+public:
+  using sc_t = std::uint64_t;
+
+  // The machine is started right away. If description is not valid(), the
+  // interpreter is left empty: operator bool is false, no state is active
+  // and dispatch() returns false.
+  explicit Interpreter(MachineDescription const& description, InterpreterHandlers handlers = {})
+  : handlers_{handlers},
+    max_completion_steps_{description.max_completion_steps}
+  {
+    if (!description.valid()) {
+      return;
+    }
+    const std::size_t n = description.states.size();
+    nodes_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+      auto const& state = description.states[i];
+      Node& node = nodes_[i];
+      node.kind = state.kind;
+      node.initial = state.initial;
+      node.entry = state.entry;
+      node.exit = state.exit;
+      node.recursive = bit(i);
+      if (i > 0) {
+        Node& parent = nodes_[state.parent];
+        if (parent.child_count++ == 0) {
+          parent.first_child = static_cast<std::uint16_t>(i);
+        }
+        parent.children |= bit(i);
+        node.ancestors = parent.ancestors | bit(state.parent);
+      }
+    }
+    for (std::size_t i = n; i-- > 1;) {
+      nodes_[description.states[i].parent].recursive |= nodes_[i].recursive;
+    }
+    // regions in the order of all_regions_t: the top state, then the regions
+    // of the orthogonal states by id
+    std::vector<std::size_t> regions{0};
+    for (std::size_t i = 0; i < n; i++) {
+      if (nodes_[i].kind == StateKind::ORTHOGONAL) {
+        for (std::size_t r = nodes_[i].first_child; r < nodes_[i].first_child + nodes_[i].child_count; r++) {
+          regions.push_back(r);
+        }
+      }
+    }
+    region_masks_.resize(regions.size());
+    for (std::size_t k = 0; k < regions.size(); k++) {
+      region_masks_[k] = nodes_[regions[k]].recursive;
+      for (std::size_t l = k + 1; l < regions.size(); l++) {
+        region_masks_[k] &= ~nodes_[regions[l]].recursive;
+      }
+    }
+    // rows grouped by source state, keeping their order
+    rows_.reserve(description.transitions.size());
+    for (std::size_t i = 0; i < n; i++) {
+      nodes_[i].first_row = static_cast<std::uint16_t>(rows_.size());
+      for (auto const& row : description.transitions) {
+        if (row.from == i) {
+          rows_.push_back(row);
+          has_completion_ = has_completion_ || row.event == completion_event;
+        }
+      }
+      nodes_[i].row_count = static_cast<std::uint16_t>(rows_.size() - nodes_[i].first_row);
+    }
+    last_.assign(n, 0);
+    last_recursive_.assign(n, 0);
+    active_child_.assign(n, no_id);
+    next_child_.assign(n, no_id);
+    start();
+  }
+
+  explicit operator bool() const {
+    return !nodes_.empty();
+  }
+
+  // Enters the initial configuration. Does nothing if already started.
+  void start() {
+    if (!started_ && *this) {
+      started_ = true;
+      construct(0, 0);
+      run_to_completion(true);
+    }
+  }
+
+  bool is_started() const {
+    return started_;
+  }
+
+  // Returns whether any state reacted to the event.
+  bool dispatch(std::uint16_t event, const void* payload = nullptr) {
+    start();
+    if (!started_) {
+      return false;
+    }
+    const bool reacted = handle(0, event, payload);
+    run_to_completion(execute());
+    return reacted;
+  }
+
+  sc_t active_states() const {
+    return started_ ? last_recursive_[0] : 0;
+  }
+
+  bool is_in_state(std::uint16_t state) const {
+    return state < size() && (active_states() & bit(state));
+  }
+
+  sc_t last(std::uint16_t state) const {
+    return state < size() ? last_[state] : 0;
+  }
+
+  sc_t last_recursive(std::uint16_t state) const {
+    return state < size() ? last_recursive_[state] : 0;
+  }
+
+  std::size_t size() const {
+    return nodes_.size();
+  }
+
+private:
+  struct Node
+  {
+    sc_t recursive = 0;
+    sc_t ancestors = 0;
+    sc_t children = 0;
+    std::uint16_t first_child = no_id;
+    std::uint16_t child_count = 0;
+    std::uint16_t initial = no_id;
+    std::uint16_t entry = no_id;
+    std::uint16_t exit = no_id;
+    std::uint16_t first_row = 0;
+    std::uint16_t row_count = 0;
+    StateKind kind = StateKind::SIMPLE;
+  };
+
+  static constexpr sc_t bit(std::size_t state) {
+    return sc_t{1} << state;
+  }
+
+  bool valid(sc_t c1, sc_t c2) const {
+    if (!c1 || !c2) {
+      return true;
+    }
+    for (sc_t mask : region_masks_) {
+      if (((c1 & ~c2) & mask) && ((c2 & ~c1) & mask)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void run(void (*handler)(void*, std::uint16_t), std::uint16_t id) {
+    if (handler && id != no_id) {
+      handler(handlers_.context, id);
+    }
+  }
+
+  bool handle(std::uint16_t state, std::uint16_t event, const void* payload) {
+    Node const& node = nodes_[state];
+    bool reacted = false;
+    if (node.kind == StateKind::COMPOSITE) {
+      if (active_child_[state] != no_id) {
+        reacted = handle(active_child_[state], event, payload);
+      }
+    }
+    else if (node.kind == StateKind::ORTHOGONAL) {
+      for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+        reacted = handle(r, event, payload) || reacted;
+      }
+    }
+    return reacted || react(node, event, payload);
+  }
+
+  bool react(Node const& node, std::uint16_t event, const void* payload) {
+    for (std::size_t i = node.first_row; i < std::size_t{node.first_row} + node.row_count; i++) {
+      TransitionRecord const& row = rows_[i];
+      if (row.event != event
+          || (row.guard != no_id && !(handlers_.guard && handlers_.guard(handlers_.context, row.guard, payload)))) {
+        continue;
+      }
+      // a rejected transition does not fire the row
+      if (row.to != no_id && !transition(row.to, row.history)) {
+        continue;
+      }
+      if (row.action != no_id) {
+        action_ = row.action;
+        action_event_ = payload;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  bool transition(std::uint16_t target, HistoryKind history) {
+    const sc_t recorded = history == HistoryKind::DEEP ? last_recursive_[target]
+        : history == HistoryKind::SHALLOW ? last_[target] : 0;
+    const sc_t branch = bit(target) | recorded | nodes_[target].ancestors;
+    if (!valid(target_branch_, branch)) {
+      return false;
+    }
+    target_branch_ |= branch;
+    return true;
+  }
+
+  bool execute() {
+    exit(0, target_branch_);
+    if (action_ != no_id) {
+      const std::uint16_t action = action_;
+      action_ = no_id;
+      if (handlers_.action) {
+        handlers_.action(handlers_.context, action, action_event_);
+      }
+    }
+    const bool entered = target_branch_;
+    enter(0, target_branch_);
+    target_branch_ = 0;
+    return entered;
+  }
+
+  void run_to_completion(bool entered) {
+    if (!has_completion_) {
+      return;
+    }
+    for (std::size_t step = 0; entered && step < max_completion_steps_; step++) {
+      handle(0, completion_event, nullptr);
+      entered = execute();
+    }
+  }
+
+  std::uint16_t next_child(Node const& node, sc_t target) const {
+    const sc_t children = target & node.children;
+    return children ? static_cast<std::uint16_t>(bit_index(children)) : node.initial;
+  }
+
+  void construct(std::uint16_t state, sc_t target) {
+    Node const& node = nodes_[state];
+    run(handlers_.entry, node.entry);
+    switch (node.kind) {
+      case StateKind::SIMPLE:
+        last_recursive_[state] = bit(state);
+        break;
+      case StateKind::COMPOSITE:
+        next_child_[state] = next_child(node, target);
+        enter(state, target);
+        break;
+      case StateKind::ORTHOGONAL:
+        for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+          construct(r, target);
+        }
+        update_orthogonal(state);
+        break;
+    }
+  }
+
+  void destroy(std::uint16_t state) {
+    Node const& node = nodes_[state];
+    if (node.kind == StateKind::COMPOSITE && active_child_[state] != no_id) {
+      destroy(active_child_[state]);
+      active_child_[state] = no_id;
+    }
+    else if (node.kind == StateKind::ORTHOGONAL) {
+      for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+        destroy(r);
+      }
+    }
+    run(handlers_.exit, node.exit);
+  }
+
+  void exit(std::uint16_t state, sc_t target) {
+    Node const& node = nodes_[state];
+    if (node.kind == StateKind::ORTHOGONAL) {
+      for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+        exit(r, target);
+      }
+    }
+    else if (node.kind == StateKind::COMPOSITE && (target & node.recursive)) {
+      if (target & last_recursive_[state] & ~bit(state)) {
+        if (active_child_[state] != no_id) {
+          exit(active_child_[state], target);
+        }
+      }
+      else {
+        if (active_child_[state] != no_id) {
+          destroy(active_child_[state]);
+          active_child_[state] = no_id;
+        }
+        next_child_[state] = next_child(node, target);
+      }
+    }
+  }
+
+  void enter(std::uint16_t state, sc_t target) {
+    Node const& node = nodes_[state];
+    if (node.kind == StateKind::ORTHOGONAL) {
+      for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+        enter(r, target);
+      }
+      update_orthogonal(state);
+    }
+    else if (node.kind == StateKind::COMPOSITE) {
+      if (next_child_[state] != no_id) {
+        const std::uint16_t child = next_child_[state];
+        construct(child, target);
+        active_child_[state] = child;
+        last_recursive_[state] = bit(state) | last_recursive_[child];
+        last_[state] = bit(child);
+        next_child_[state] = no_id;
+      }
+      else if (active_child_[state] != no_id) {
+        enter(active_child_[state], target);
+        last_recursive_[state] = bit(state) | last_recursive_[active_child_[state]];
+      }
+    }
+  }
+
+  void update_orthogonal(std::uint16_t state) {
+    Node const& node = nodes_[state];
+    last_recursive_[state] = bit(state);
+    last_[state] = bit(state);
+    for (std::uint16_t r = node.first_child; r < node.first_child + node.child_count; r++) {
+      last_recursive_[state] |= last_recursive_[r];
+      last_[state] |= last_[r];
+    }
+  }
+
+  std::vector<Node> nodes_;
+  std::vector<TransitionRecord> rows_;
+  std::vector<sc_t> region_masks_;
+  std::vector<sc_t> last_;
+  std::vector<sc_t> last_recursive_;
+  std::vector<std::uint16_t> active_child_;
+  std::vector<std::uint16_t> next_child_;
+  InterpreterHandlers handlers_;
+  std::size_t max_completion_steps_;
+  sc_t target_branch_ = 0;
+  std::uint16_t action_ = no_id;
+  const void* action_event_ = nullptr;
+  bool has_completion_ = false;
+  bool started_ = false;
+};
+
+template <typename TopState_, typename Events_, typename ... State_>
+void describe_states(MachineDescription& description, type_identity<std::tuple<State_...>>) {
+  auto describe_state = [&](auto state) {
+    using State = typename decltype(state)::type;
+    StateRecord record;
+    if constexpr(!std::is_same_v<State, TopState_>) {
+      record.parent = static_cast<std::uint16_t>(state_id_v<parent_t<State>>);
+    }
+    if constexpr(std::is_same_v<base_t<State>, CompositeStateBase>) {
+      record.kind = StateKind::COMPOSITE;
+      record.initial = static_cast<std::uint16_t>(state_id_v<initial_state_t<State>>);
+    }
+    else if constexpr(std::is_same_v<base_t<State>, OrthogonalStateBase>) {
+      record.kind = StateKind::ORTHOGONAL;
+    }
+    if constexpr(has_on_entry_v<State>) {
+      record.entry = static_cast<std::uint16_t>(state_id_v<State>);
+    }
+    if constexpr(!std::is_same_v<NOT_IMPLEMENTED, decltype(std::declval<StateMixin<State>&>().on_exit())>) {
+      record.exit = static_cast<std::uint16_t>(state_id_v<State>);
+    }
+    description.states.push_back(record);
+  };
+  (describe_state(type_identity<State_>{}), ...);
+}
+
+template <typename Events_, typename Event_>
+constexpr std::uint16_t event_id() {
+  if constexpr(std::is_same_v<Event_, Completion>) {
+    return completion_event;
+  }
+  else {
+    return static_cast<std::uint16_t>(index_v<Event_, Events_>);
+  }
+}
+
+template <typename Events_, typename ... Row_>
+void describe_transitions(MachineDescription& description, type_identity<std::tuple<Row_...>>) {
+  std::uint16_t index = 0;
+  auto describe_row = [&](auto row) {
+    using Row = typename decltype(row)::type;
+    using To = typename Row::To;
+    TransitionRecord record{static_cast<std::uint16_t>(state_id_v<typename Row::From>), event_id<Events_, typename Row::Event>()};
+    record.to = static_cast<std::uint16_t>(state_id_v<target_state_t<To>>);
+    if constexpr(std::is_base_of_v<DeepHistoryBase, To>) {
+      record.history = HistoryKind::DEEP;
+    }
+    else if constexpr(std::is_base_of_v<HistoryBase, To>) {
+      record.history = HistoryKind::SHALLOW;
+    }
+    if constexpr(!std::is_void_v<typename Row::Guard>) {
+      record.guard = index;
+    }
+    if constexpr(!std::is_void_v<typename Row::Action>) {
+      record.action = index;
+    }
+    description.transitions.push_back(record);
+    index++;
+  };
+  (describe_row(type_identity<Row_>{}), ...);
+}
+
+// Description of the machine with top state TopState_ and its Transitions,
+// with events numbered by their index in Events_. Handler ids: the entry and
+// exit handlers of a state with on_entry() / on_exit() have its state id; the
+// guard and action of a row have the row's index.
+template <typename TopState_, typename Events_>
+MachineDescription describe() {
+  MachineDescription description;
+  description.max_completion_steps = static_cast<std::uint8_t>(max_completion_steps_v<TopState_>);
+  describe_states<TopState_, Events_>(description, type_identity<all_states_t<TopState_>>{});
+  describe_transitions<Events_>(description, type_identity<transitions_t<TopState_>>{});
+  return description;
+}
+
+}
@@ -0,0 +1,149 @@
+// Real-time figures of a machine: built by the `introspect` target, which runs
+// it after linking. Prints the compile-time report of introspection.hpp and,
+// given the call graph of this translation unit (GCC -fcallgraph-info=su), the
+// worst-case stack depth of every dispatch: the frames summed along the deepest
+// call path. Replace the machine below with your own, and gate the build on
+// budgets with static_assert.
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "metahsm.hpp"
+#include "introspection.hpp"
+#include "lifecycle.hpp"
+
+using namespace metahsm;
+
+// budgets
+static_assert(max_depth_v<LifecycleTopState> <= 4);
+static_assert(max_react_calls_v<LifecycleTopState, Event<CLEANUP>> <= 2);
+static_assert(sizeof(StateMachine<LifecycleTopState>) <= 4096);
+
+// Kept out of line so that the dispatches it inlines show up as one node of
+// the call graph even when StateMachine::dispatch itself is inlined.
+[[gnu::noinline]] void dispatch_lifecycle(StateMachine<LifecycleTopState> & lifecycle) {
+  lifecycle.dispatch<Event<CONFIGURE>>();
+  lifecycle.dispatch<Event<ACTIVATE>>();
+  lifecycle.dispatch<Event<CLEANUP>>();
+  lifecycle.dispatch<Event<DEACTIVATE>>();
+}
+
+struct CallGraphNode
+{
+  std::string name;
+  std::size_t frame = 0;
+  bool sized = false;    // false for functions defined outside this translation unit
+  bool dynamic = false;
+  std::vector<std::string> callees;
+};
+
+struct StackPath
+{
+  std::size_t bytes = 0;
+  bool unknown = false;  // a call on the path leaves the graph: bytes is a lower bound
+  bool failed = false;   // a dynamic frame or a cycle: the path has no bound
+};
+
+// Reads the quoted value following key in a VCG line, empty if there is none.
+std::string vcg_field(std::string const& line, char const* key) {
+  const std::size_t begin = line.find(key);
+  if (begin == std::string::npos) {
+    return {};
+  }
+  const std::size_t value = begin + std::char_traits<char>::length(key);
+  return line.substr(value, line.find('"', value) - value);
+}
+
+// Worst path from title: the frame of every function on it summed, walking
+// each function once. on_path marks the functions of the current path, so
+// that recursion is reported instead of followed.
+StackPath deepest_path(std::map<std::string, CallGraphNode> const& graph, std::string const& title,
+    std::map<std::string, StackPath> & done, std::map<std::string, bool> & on_path) {
+  if (on_path[title]) {
+    std::printf("  recursion through %s\n", graph.count(title) ? graph.at(title).name.c_str() : title.c_str());
+    return {0, false, true};
+  }
+  if (auto found = done.find(title); found != done.end()) {
+    return found->second;
+  }
+  auto node = graph.find(title);
+  if (node == graph.end() || !node->second.sized) {
+    return done[title] = {0, true, false};
+  }
+  if (node->second.dynamic) {
+    std::printf("  dynamic frame in %s\n", node->second.name.c_str());
+  }
+  on_path[title] = true;
+  StackPath deepest;
+  for (std::string const& callee : node->second.callees) {
+    StackPath path = deepest_path(graph, callee, done, on_path);
+    deepest.unknown |= path.unknown;
+    deepest.failed |= path.failed;
+    deepest.bytes = path.bytes > deepest.bytes ? path.bytes : deepest.bytes;
+  }
+  on_path[title] = false;
+  deepest.bytes += node->second.frame;
+  deepest.failed |= node->second.dynamic;
+  return done[title] = deepest;
+}
+
+// Prints the worst-case stack of every function whose name mentions dispatch
+// from a GCC .ci file, whose nodes label a function with its name, location
+// and "N bytes (qualifiers)", and whose edges are its calls. Calls leaving the
+// translation unit and indirect calls (transition actions) are not followed,
+// so such totals are printed as lower bounds. Returns false if a dispatch
+// reaches a dynamic frame or a recursion, whose stack has no static bound.
+bool print_stack_usage(char const* path) {
+  std::ifstream ci(path);
+  if (!ci) {
+    std::printf("  no call graph file %s\n", path);
+    return false;
+  }
+  std::map<std::string, CallGraphNode> graph;
+  std::string line;
+  while (std::getline(ci, line)) {
+    if (line.compare(0, 5, "node:") == 0) {
+      CallGraphNode & node = graph[vcg_field(line, "title: \"")];
+      const std::string label = vcg_field(line, "label: \"");
+      node.name = label.substr(0, label.find("\\n"));
+      const std::size_t bytes = label.find(" bytes (");
+      if (bytes != std::string::npos) {
+        node.frame = std::strtoul(label.c_str() + label.rfind("\\n", bytes) + 2, nullptr, 10);
+        node.sized = true;
+        node.dynamic = label.find("dynamic", bytes) != std::string::npos;
+      }
+    }
+    else if (line.compare(0, 5, "edge:") == 0) {
+      graph[vcg_field(line, "sourcename: \"")].callees.push_back(vcg_field(line, "targetname: \""));
+    }
+  }
+  bool bounded = true;
+  std::size_t roots = 0;
+  std::map<std::string, StackPath> done;
+  std::map<std::string, bool> on_path;
+  for (auto const& [title, node] : graph) {
+    if (!node.sized || node.name.find("dispatch") == std::string::npos) {
+      continue;
+    }
+    roots++;
+    const StackPath deepest = deepest_path(graph, title, done, on_path);
+    bounded &= !deepest.failed;
+    std::printf("  %s: %s%zu bytes of stack%s\n", node.name.c_str(), deepest.unknown ? "at least " : "",
+        deepest.bytes, deepest.failed ? ", unbounded" : "");
+  }
+  if (roots == 0) {
+    std::printf("  no dispatch in the call graph %s\n", path);
+    return false;
+  }
+  return bounded;
+}
+
+int main(int argc, char* argv[]) {
+  print_report<LifecycleTopState, Event<CONFIGURE>, Event<CLEANUP>, Event<ACTIVATE>, Event<DEACTIVATE>>();
+  const bool bounded = argc <= 1 || print_stack_usage(argv[1]);
+  StateMachine<LifecycleTopState> lifecycle;
+  dispatch_lifecycle(lifecycle);
+  return bounded && lifecycle.is_in_state<LifecycleTopState::Inactive>() ? 0 : 1;
+}
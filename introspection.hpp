@@ -0,0 +1,131 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <tuple>
+
+#include "metahsm.hpp"
+
+// Compile-time figures of a machine for proving real-time bounds, e.g.
+//
+//   static_assert(max_react_calls_v<MyTopState, Event<CLEANUP>> <= 6);
+//   static_assert(max_depth_v<MyTopState> <= 5);
+//
+// Stack usage is not known to the compiler front end; the `introspect` tool
+// target builds with -fcallgraph-info=su and prints the worst call path of
+// every dispatch next to print_report().
+
+namespace metahsm {
+
+// Nesting depth of the wrapper recursion below State_, State_ counting as 1.
+template <typename State_>
+struct max_depth;
+
+template <typename ... State_>
+constexpr std::size_t max_depth_of(type_identity<std::tuple<State_...>>) {
+  std::size_t depth = 0;
+  ((depth = max_depth<State_>::value > depth ? max_depth<State_>::value : depth), ...);
+  return depth;
+}
+
+template <typename State_>
+struct max_depth : std::integral_constant<std::size_t, 1 + max_depth_of(type_identity<contained_states_direct_t<State_>>{})> {};
+
+template <typename State_>
+constexpr std::size_t max_depth_v = max_depth<State_>::value;
+
+// Upper bound of the react() calls (own reactions and table rows) one
+// dispatch of Event_ makes below State_: every active region is asked, and a
+// state is counted even when its reaction would be skipped because an inner
+// state already reacted.
+template <typename State_, typename Event_, typename StateBase_ = base_t<State_>>
+struct max_react_calls;
+
+template <typename State_, typename Event_>
+constexpr std::size_t own_react_calls_v = StateWrapper<State_>::template has_react<Event_> ? 1 : 0;
+
+template <typename Event_, typename ... State_>
+constexpr std::size_t max_react_calls_max(type_identity<std::tuple<State_...>>) {
+  std::size_t calls = 0;
+  ((calls = max_react_calls<State_, Event_>::value > calls ? max_react_calls<State_, Event_>::value : calls), ...);
+  return calls;
+}
+
+template <typename Event_, typename ... State_>
+constexpr std::size_t max_react_calls_sum(type_identity<std::tuple<State_...>>) {
+  return (std::size_t{0} + ... + max_react_calls<State_, Event_>::value);
+}
+
+template <typename State_, typename Event_>
+struct max_react_calls<State_, Event_, SimpleStateBase>
+    : std::integral_constant<std::size_t, own_react_calls_v<State_, Event_>> {};
+
+template <typename State_, typename Event_>
+struct max_react_calls<State_, Event_, CompositeStateBase>
+    : std::integral_constant<std::size_t, own_react_calls_v<State_, Event_>
+        + max_react_calls_max<Event_>(type_identity<contained_states_direct_t<State_>>{})> {};
+
+template <typename State_, typename Event_>
+struct max_react_calls<State_, Event_, OrthogonalStateBase>
+    : std::integral_constant<std::size_t, own_react_calls_v<State_, Event_>
+        + max_react_calls_sum<Event_>(type_identity<contained_states_direct_t<State_>>{})> {};
+
+template <typename TopState_, typename Event_>
+constexpr std::size_t max_react_calls_v = max_react_calls<TopState_, Event_>::value;
+
+struct StateFootprint
+{
+  std::string_view name;
+  std::size_t depth;        // 1 for the top state
+  std::size_t mixin_size;   // sizeof(StateMixin<State>), the state's storage
+  std::size_t wrapper_size; // sizeof(wrapper_t<State>), including the active substates
+};
+
+template <typename ... State_>
+constexpr auto state_footprints(type_identity<std::tuple<State_...>>) {
+  return std::array<StateFootprint, sizeof...(State_)>{StateFootprint{
+      get_type_name<State_>(),
+      std::tuple_size_v<super_state_recursive_t<State_>> + 1,
+      sizeof(StateMixin<State_>),
+      sizeof(wrapper_t<State_>)}...};
+}
+
+// Footprint of each state, indexed by state id.
+template <typename TopState_>
+constexpr auto state_footprints_v = state_footprints(type_identity<all_states_t<TopState_>>{});
+
+// Prints the figures above for TopState_ and the given events.
+template <typename TopState_, typename ... Event_>
+void print_report(std::FILE* out = stdout) {
+  std::fprintf(out, "machine %.*s\n", static_cast<int>(get_type_name<TopState_>().size()), get_type_name<TopState_>().data());
+  std::fprintf(out, "  states: %zu, max depth: %zu, sizeof(StateMachine): %zu\n",
+      std::tuple_size_v<all_states_t<TopState_>>, max_depth_v<TopState_>, sizeof(StateMachine<TopState_>));
+  std::fprintf(out, "  %5s %5s %7s %8s  state\n", "id", "depth", "mixin", "wrapper");
+  std::size_t id = 0;
+  for (auto const& state : state_footprints_v<TopState_>) {
+    std::fprintf(out, "  %5zu %5zu %7zu %8zu  %.*s\n", id++, state.depth, state.mixin_size, state.wrapper_size,
+        static_cast<int>(state.name.size()), state.name.data());
+  }
+  auto print_event = [out](std::string_view name, std::size_t calls) {
+    std::fprintf(out, "  dispatch of %.*s: at most %zu react calls\n", static_cast<int>(name.size()), name.data(), calls);
+  };
+  (print_event(get_type_name<Event_>(), max_react_calls_v<TopState_, Event_>), ...);
+}
+
+}
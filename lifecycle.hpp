@@ -0,0 +1,119 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Machines shared by the tests, the footprint and the introspect programs, so
+// that their figures describe the machines the tests exercise. Nothing here
+// prints unless the includer defines LIFECYCLE_LOG: the footprint profile must
+// not pull in <iostream>.
+#include <cassert>
+#include "metahsm.hpp"
+
+#ifndef LIFECYCLE_LOG
+#define LIFECYCLE_LOG(text) ((void)0)
+#endif
+
+enum LifecycleEvent
+{
+  CONFIGURE,
+  CLEANUP,
+  ACTIVATE,
+  DEACTIVATE
+};
+
+template <auto e>
+struct Event{};
+
+struct LifecycleTopState : metahsm::State<LifecycleTopState>
+{
+  struct Unconfigured : State
+  {
+    void react(Event<CONFIGURE>); // -> Inactive
+  };
+  struct Inactive : State
+  {
+    void react(Event<ACTIVATE>); // -> Active
+  };
+  struct Active : State
+  {
+    inline void react(Event<DEACTIVATE>) {
+      transition<Inactive>();
+    }
+    int i = 0;
+    struct Operation : Region
+    {
+      struct Monitoring : State
+      {
+        inline void react(Event<ACTIVATE>) {
+          transition<Commanding>();
+          transition_action(&Monitoring::action);
+        }
+        inline void action() { LIFECYCLE_LOG("Action!"); }
+      };
+      struct Commanding : State
+      {
+        inline void react(Event<CLEANUP>) {
+          LIFECYCLE_LOG("Before Action1!");
+          transition<Monitoring>();
+          transition<Safety::Error>();
+          transition_action([] { LIFECYCLE_LOG("Action1!"); });
+        }
+      };
+      using SubStates = std::tuple<Monitoring, Commanding>;
+    };
+    struct Safety : Region
+    {
+      struct Ok : State
+      {
+        inline void react(Event<CLEANUP>) {
+          LIFECYCLE_LOG("Before Action3!");
+          transition_action([] { LIFECYCLE_LOG("Action3!"); });
+        }
+      };
+      struct Error : State
+      { };
+      using SubStates = std::tuple<Ok, Error>;
+    };
+    using Regions = std::tuple<Operation, Safety>;
+  };
+  using SubStates = std::tuple<Unconfigured, Inactive, Active>;
+};
+
+// defined out of line, and reaching the context of a state that is not active
+inline void LifecycleTopState::Unconfigured::react(Event<CONFIGURE>) {
+  transition<Inactive>();
+  context<Active>().i = 1;
+}
+
+inline void LifecycleTopState::Inactive::react(Event<ACTIVATE>) {
+  transition<metahsm::History<Active>>();
+  assert(is_in_state<Inactive>());
+}
+
+// a StateTemplate instantiated as the region of a top state
+template <typename Config>
+struct TLC3 : metahsm::StateTemplate<TLC3>, Config
+{
+  struct Unconfigured : State, Config
+  {
+    inline void react(Event<CONFIGURE>) { transition<Unconfigured>(); }
+  };
+  using SubStates = std::tuple<Unconfigured>;
+};
+
+struct TLC3TopState : metahsm::State<TLC3TopState>
+{
+  using Regions = std::tuple<TLC3<metahsm::TopStateRebind<TLC3TopState>>>;
+};
@@ -14,16 +14,38 @@
 
 #pragma once
 
+// Hosted profile: asynchronous transition actions (<chrono>), configurations
+// published to other threads (<atomic>), resident mirrors, wire dispatch and
+// std::span overloads. Define METAHSM_HOSTED=0 to build on a freestanding
+// toolchain without them; transition actions must then be trivially copyable.
+#ifndef METAHSM_HOSTED
+#define METAHSM_HOSTED 1
+#endif
+
 #include <type_traits>
 #include <tuple>
 #include <variant>
-#include <functional>
 #include <optional>
-#include <random>
-#include <cmath>
+#include <cstring>
+#include <new>
+#if METAHSM_HOSTED
+#include <chrono>
+#include <atomic>
+#if __has_include(<span>)
+#include <span>
+#endif
+#endif
+#if defined(__cpp_exceptions)
+#include <exception>
+#endif
 
 #include "type_traits.hpp"
 #include "trace.hpp"
+#if METAHSM_HOSTED
+#include "wire.hpp"
+#include "resident_slot.hpp"
+#include "inplace_function.hpp"
+#endif
 
 namespace metahsm {
 
@@ -68,20 +90,111 @@ decltype(auto) visit(Callable_ && fun, Variant_ && v) {
 //                                     STATE TEMPLATE - USER API                                       //
 //=====================================================================================================//
 
+#if METAHSM_HOSTED
+// An asynchronous transition action returns a future-like object: anything
+// with wait_for() returning a status with a `ready` enumerator, and get().
+template <typename Pending_, typename _SFINAE = void>
+struct is_pending : std::false_type {};
+
+template <typename Pending_>
+struct is_pending<Pending_, std::void_t<
+    decltype(std::declval<Pending_&>().wait_for(std::chrono::seconds(0)) == decltype(std::declval<Pending_&>().wait_for(std::chrono::seconds(0)))::ready),
+    decltype(std::declval<Pending_&>().get())>> : std::true_type {};
+
+template <typename Pending_>
+constexpr bool is_pending_v = is_pending<Pending_>::value;
+
+using TransitionAction = InplaceFunction<void()>;
+using PendingAction = InplaceFunction<bool()>;
+#else
+#ifndef METAHSM_ACTION_CAPACITY
+#define METAHSM_ACTION_CAPACITY 64
+#endif
+
+// Transition action of the freestanding profile: a trivially copyable
+// callable kept in a fixed buffer, with nothing to destroy or relocate.
+class TransitionAction
+{
+public:
+  TransitionAction() = default;
+
+  template <typename Callable_, typename = std::enable_if_t<!std::is_same_v<Callable_, TransitionAction>>>
+  TransitionAction(Callable_ const& callable) {
+    static_assert(std::is_trivially_copyable_v<Callable_>, "transition actions must be trivially copyable without METAHSM_HOSTED");
+    static_assert(sizeof(Callable_) <= METAHSM_ACTION_CAPACITY && alignof(Callable_) <= alignof(std::max_align_t),
+        "callable too large for in-place storage, raise METAHSM_ACTION_CAPACITY");
+    ::new (static_cast<void*>(storage_)) Callable_(callable);
+    invoke_ = [](void* storage) { (*static_cast<Callable_*>(storage))(); };
+  }
+
+  explicit operator bool() const {
+    return invoke_ != nullptr;
+  }
+
+  void operator()() {
+    invoke_(storage_);
+  }
+
+  void reset() {
+    invoke_ = nullptr;
+  }
+
+private:
+  alignas(std::max_align_t) unsigned char storage_[METAHSM_ACTION_CAPACITY];
+  void (*invoke_)(void*) = nullptr;
+};
+
+// Without asynchronous actions no transition is ever left pending.
+struct PendingAction
+{
+  explicit constexpr operator bool() const { return false; }
+  constexpr bool operator()() const { return true; }
+  constexpr void reset() {}
+};
+#endif
+
 class StateMachineBase
 {
 public:
   template <typename Callable_>
   void transition_action(Callable_ const& action) {
-    action_ = action;
+    using Result = std::invoke_result_t<Callable_ const&>;
+    if constexpr(std::is_void_v<Result>) {
+      action_ = action;
+    }
+    else {
+#if METAHSM_HOSTED
+      static_assert(is_pending_v<Result>, "transition actions return void or a future");
+      action_ = [this, action] {
+        pending_ = [pending = action()]() mutable {
+          if(pending.wait_for(std::chrono::seconds(0)) != decltype(pending.wait_for(std::chrono::seconds(0)))::ready) {
+            return false;
+          }
+          pending.get();
+          return true;
+        };
+      };
+#else
+      static_assert(std::is_void_v<Result>, "asynchronous transition actions need METAHSM_HOSTED");
+#endif
+    }
+  }
+
+  // True between the exit and the entry of a transition whose asynchronous
+  // action has not completed yet.
+  bool is_in_transition() const {
+    return static_cast<bool>(pending_);
   }
 
 protected:
-  std::optional<std::function<void()>> action_;
+  TransitionAction action_;
+  PendingAction pending_;
 };
 template <typename TopState_>
 class StateMachine;
 class StateImplBase;
+template <typename TopState_>
+struct Route;
 
 struct HistoryBase
 {};
@@ -104,6 +217,106 @@ struct History : HistoryBase
   };
 };
 
+// Row of the declarative transition table of a machine, declared on its top
+// state as `using Transitions = std::tuple<Transition<...>, ...>`. When From
+// is active and Event is dispatched, the first row whose Guard accepts and
+// whose transition to To (a state or a History) is not rejected fires, and
+// Action becomes the transition action. Guard and Action are default-constructible callables taking
+// (From&, Event const&); void means none. Rows are tried before From's own
+// react(), which only runs if no row fired.
+template <typename From_, typename Event_, typename To_, typename Guard_ = void, typename Action_ = void>
+struct Transition
+{
+  using From = From_;
+  using Event = Event_;
+  using To = To_;
+  using Guard = Guard_;
+  using Action = Action_;
+};
+
+template <typename State_, typename Event_>
+struct row_of
+{
+  template <typename Row_>
+  struct test : std::bool_constant<std::is_same_v<typename Row_::From, State_> && std::is_same_v<typename Row_::Event, Event_>> {};
+};
+
+// Rows of the transition table of TopState_ leaving State_ on Event_.
+template <typename TopState_, typename State_, typename Event_>
+using transition_rows_t = tuple_filter_t<row_of<State_, Event_>::template test, transitions_t<TopState_>>;
+
+template <typename TopState_, typename Rows_ = transitions_t<TopState_>>
+struct is_transition_table_valid;
+
+template <typename TopState_, typename ... Row_>
+struct is_transition_table_valid<TopState_, std::tuple<Row_...>>
+{
+  static constexpr bool value = ((tuple_contains_v<typename Row_::From, declared_states_t<TopState_>>
+      && tuple_contains_v<target_state_t<typename Row_::To>, declared_states_t<TopState_>>) && ...);
+};
+
+// Conflict policies. Transitions requested by different states in one step
+// conflict if they target different states of the same region (see is_valid).
+// Without a ConflictPolicy on the top state, the first valid request wins and
+// later ones are rejected by transition(). With one, each reacting state's
+// requests are resolved as a unit after its react(), by rank: the higher rank
+// wins, ties keep the earlier request.
+struct FirstWins
+{
+  template <typename State_>
+  static constexpr int rank = 0;
+  static constexpr bool reject_all = false;
+};
+
+// Deeper source states win.
+struct InnerFirst
+{
+  template <typename State_>
+  static constexpr int rank = static_cast<int>(std::tuple_size_v<super_state_recursive_t<State_>>);
+  static constexpr bool reject_all = false;
+};
+
+// Shallower source states win.
+struct OuterFirst
+{
+  template <typename State_>
+  static constexpr int rank = -static_cast<int>(std::tuple_size_v<super_state_recursive_t<State_>>);
+  static constexpr bool reject_all = false;
+};
+
+// The source in the region with the higher `static constexpr int priority`
+// wins; regions without one have priority 0.
+struct RegionPriority
+{
+  template <typename State_>
+  static constexpr int rank = state_region_priority_v<State_>;
+  static constexpr bool reject_all = false;
+};
+
+// All conflicting requests are dropped.
+struct RejectAll
+{
+  template <typename State_>
+  static constexpr int rank = 0;
+  static constexpr bool reject_all = true;
+};
+
+// Conflicts seen since the start of the last dispatch(), including its
+// completion steps. States are given as state combinations.
+template <typename StateCombination_>
+struct ConflictReport
+{
+  std::size_t conflicts = 0;
+  StateCombination_ sources = 0;
+  StateCombination_ rejected = 0;
+};
+
+// Anonymous (completion) event, dispatched internally right after a transition
+// until the configuration is stable or max_completion_steps_v is reached, which
+// StateMachine::is_stable() reports.
+struct Completion
+{};
+
 struct StateMixinBase;
 template <typename TopState_>
 struct StateMixinCommon;
@@ -114,9 +327,14 @@ struct NOT_IMPLEMENTED
 class StateImplBase
 {
 public:
-  // internal
-  StateMachineBase & state_machine_;
-
+  // internal, set by the state machine holding the state
+  StateMachineBase * state_machine_ = nullptr;
+
+  // Returns whether the target was accepted. Without a ConflictPolicy that is
+  // final. With one, true only means the target is consistent with the other
+  // requests of this react(): after it returns, the requests are resolved
+  // against those of other states and may still be rejected, together with
+  // the transition action (see conflict_report()).
   template <typename Target_>
   bool transition() {
     if constexpr(std::is_base_of_v<HistoryBase, Target_>) {
@@ -129,7 +347,7 @@ public:
 
   template <typename Callable_>
   bool transition_action(Callable_ const& action)  {
-    state_machine_.transition_action(action);
+    state_machine_->transition_action(action);
     return true;
   }
 
@@ -139,7 +357,14 @@ public:
       return false;
     }
     auto state = static_cast<SourceState_*>(this);
-    return transition_action(std::bind(action, state));
+    return transition_action([state, action] { (state->*action)(); });
+  }
+
+  // Posts an event to the machine with top state Target_ over the bus the
+  // current thread is bound to (see bus.hpp). Returns false if the channel is full.
+  template <typename Target_, typename Event_>
+  bool send(Event_ const& event, std::uint32_t instance = 0) {
+    return Route<Target_>::send(event, instance);
   }
 
   template <typename State_>
@@ -160,7 +385,7 @@ public:
 private:
   template <typename TopState>
   auto& state_machine() {
-    return static_cast<StateMachine<TopState>&>(state_machine_); // TODO rtti check
+    return static_cast<StateMachine<TopState>&>(*state_machine_); // TODO rtti check
   }
 };
 
@@ -224,6 +449,17 @@ template <template <typename> typename TopStateTemplate_>
 using RegionTemplate = StateTemplateImpl<TopStateTemplate_>;
 
 
+struct deferred_start_t
+{};
+
+inline constexpr deferred_start_t deferred_start{};
+
+template <typename State_>
+constexpr bool has_on_entry_v = !std::is_same_v<NOT_IMPLEMENTED, decltype(std::declval<StateMixin<State_>&>().on_entry())>;
+
+template <typename State_>
+constexpr bool has_on_exit_v = !std::is_same_v<NOT_IMPLEMENTED, decltype(std::declval<StateMixin<State_>&>().on_exit())>;
+
 template <typename State_>
 struct WrapperArgs
 {
@@ -240,7 +476,13 @@ public:
   using State = State_;
   using Mixin = StateMixin<State>;
   template <typename Event_>
-  static constexpr bool has_react = !std::is_same_v<NOT_IMPLEMENTED, decltype(std::declval<Mixin>().react(std::declval<Event_>()))>;
+  using Rows = transition_rows_t<TopState, State_, Event_>;
+  template <typename Event_>
+  static constexpr bool has_rows = std::tuple_size_v<Rows<Event_>> > 0;
+  template <typename Event_>
+  static constexpr bool has_own_react = !std::is_same_v<NOT_IMPLEMENTED, decltype(std::declval<Mixin>().react(std::declval<Event_>()))>;
+  template <typename Event_>
+  static constexpr bool has_react = has_rows<Event_> || has_own_react<Event_>;
 
   StateWrapper(WrapperArgs<State_> args)
   : state_{args.state},
@@ -255,22 +497,35 @@ public:
   ~StateWrapper()
   {
     trace_exit<State_>();
-    if constexpr(!std::is_same_v<NOT_IMPLEMENTED, decltype(state_.on_entry())>) {
+    if constexpr(!std::is_same_v<NOT_IMPLEMENTED, decltype(state_.on_exit())>) {
       state_.on_exit();
     }
   }
 
   template <typename Event_>
   bool handle_event(const Event_& e) {
+    return react_to(state_, state_machine_, e);
+  }
+
+  // The reaction of an active state to e: its table rows, then its react().
+  template <typename Event_>
+  static bool react_to(Mixin & state, StateMachine & state_machine, const Event_& e) {
     bool result = false;
-    if constexpr(std::is_void_v<decltype(state_.react(e))>) {
-      state_.react(e);
-      result = true;
+    if constexpr(has_rows<Event_>) {
+      result = fire_rows(state, state_machine, e, type_identity<Rows<Event_>>{});
     }
-    else {
-      result = state_.react(e);
+    if constexpr(has_own_react<Event_>) {
+      if(!result) {
+        if constexpr(std::is_void_v<decltype(state.react(e))>) {
+          state.react(e);
+          result = true;
+        }
+        else {
+          result = state.react(e);
+        }
+      }
     }
-    state_machine_.template post_react<State_>(result);
+    state_machine.template post_react<State_>(result);
     return result;
   }
 
@@ -281,6 +536,29 @@ public:
 protected:
   StateMixin<State_> & state_;
   StateMachine & state_machine_;
+
+private:
+  template <typename Event_, typename ... Row_>
+  static bool fire_rows(Mixin & state, StateMachine & state_machine, const Event_& e, type_identity<std::tuple<Row_...>>) {
+    return (fire_row<Row_>(state, state_machine, e) || ...);
+  }
+
+  template <typename Row_, typename Event_>
+  static bool fire_row(Mixin & mixin, StateMachine & state_machine, const Event_& e) {
+    if constexpr(!std::is_void_v<typename Row_::Guard>) {
+      if(!typename Row_::Guard{}(mixin, e)) {
+        return false;
+      }
+    }
+    if(!state_machine.template transition<typename Row_::To>()) {
+      return false;
+    }
+    if constexpr(!std::is_void_v<typename Row_::Action>) {
+      State_& state = mixin;
+      state_machine.transition_action([&state, &e] { return typename Row_::Action{}(state, e); });
+    }
+    return true;
+  }
 };
 
 template <typename State_>
@@ -311,28 +589,68 @@ struct has_react<Event_, std::tuple<StateWrapper_...>>
   static constexpr bool value = (StateWrapper_::template HAS_REACT_RECURSIVE<Event_> || ...);
 };
 
+// Handler mask: the states of TopState_ that react to Event_. An event is
+// handled in a configuration iff the mask intersects its active states.
+template <typename Event_, typename ... State_>
+constexpr std::uint64_t handler_mask(type_identity<std::tuple<State_...>>) {
+  return ((StateWrapper<State_>::template has_react<Event_> ? state_combination_v<State_> : 0) | ... | 0);
+}
+
+template <typename TopState_, typename Event_>
+constexpr state_combination_t<TopState_> handler_mask_v = handler_mask<Event_>(type_identity<all_states_t<TopState_>>{});
+
+
+// Bit layout of a composite state, and the decisions of its wrapper that only
+// depend on it. Each composite state has its own wrapper code; sub-machines
+// instantiated many times can share one instead (see SharedCompositeWrapper).
+struct CompositeLayout
+{
+  std::uint64_t self;
+  std::uint64_t sub_states;
+  std::uint64_t recursive;
+  std::size_t initial;
+};
+
+enum class SubStateExit
+{
+  NONE,
+  NESTED,
+  ALL
+};
+
+inline std::size_t next_sub_state(CompositeLayout const& layout, std::uint64_t target) {
+  return (target & layout.sub_states) ? bit_index(target & layout.sub_states) : layout.initial;
+}
+
+inline SubStateExit sub_state_exit(CompositeLayout const& layout, std::uint64_t target, std::uint64_t last_recursive) {
+  if (!(target & layout.recursive)) {
+    return SubStateExit::NONE;
+  }
+  return (target & last_recursive & ~layout.self) ? SubStateExit::NESTED : SubStateExit::ALL;
+}
 
 template <typename State_>
 class CompositeStateWrapper : public StateWrapper<State_>
 {
 public:
   using TopState = top_state_t<State_>;
-  using SubStates = typename State_::SubStates;
+  using SubStates = contained_states_direct_t<State_>;
   using SubStateWrappers = tuple_apply_t<wrapper_t, SubStates>;
   using typename StateWrapper<State_>::StateMachine;
   static constexpr std::size_t N = std::tuple_size_v<SubStates>;
   template <typename Event_> // TODO check if needed
   static constexpr bool HAS_REACT_RECURSIVE = StateWrapper<State_>::template has_react<Event_> | has_react<Event_, SubStateWrappers>::value;
 
+  static constexpr CompositeLayout layout{
+    state_combination_v<State_>,
+    state_combination_v<SubStates>,
+    state_combination_recursive_v<State_>,
+    state_id_v<initial_state_t<State_>>};
+
   CompositeStateWrapper(WrapperArgs<State_> args)
-  : StateWrapper<State_>(args)
+  : StateWrapper<State_>(args),
+    next_state_id_{next_sub_state(layout, args.target)}
   {
-    if (args.target & state_combination_v<SubStates>) {
-      next_state_id_ = bit_index(args.target & state_combination_v<SubStates>);
-    }
-    else {
-      next_state_id_ = state_id_v<initial_state_t<State_>>;
-    }
     enter(args.target);
   }
 
@@ -357,23 +675,21 @@ public:
   }
 
   void exit(state_combination_t<TopState> const& target) {
-    if ((target & state_combination_recursive_v<State_>)) {
-      if ((target & this->state().last_recursive & ~state_combination_v<State_>)) {
+    switch (sub_state_exit(layout, target, this->state().last_recursive)) {
+      case SubStateExit::NESTED: {
         auto sub_exit = overload{
             [&](auto& sub) { sub.exit(target); },
             [](std::monostate) { }
         };
         visit(sub_exit, active_sub_state_);
+        break;
       }
-      else {
+      case SubStateExit::ALL:
         active_sub_state_ = std::monostate{};
-        if (target & state_combination_v<SubStates>) {
-          next_state_id_ = bit_index(target & state_combination_v<SubStates>);
-        }
-        else {
-          next_state_id_ = state_id_v<initial_state_t<State_>>;
-        }
-      }
+        next_state_id_ = next_sub_state(layout, target);
+        break;
+      case SubStateExit::NONE:
+        break;
     }
   }
 
@@ -397,7 +713,10 @@ template <auto ... I>
     }
     else {
       auto sub_enter = overload{
-        [&](auto& sub) { sub.enter(target); },
+        [&](auto& sub) {
+          sub.enter(target);
+          this->state().last_recursive = state_combination_v<State_> | sub.state().last_recursive;
+        },
         [](std::monostate) { }
       };
       visit(sub_enter, active_sub_state_);
@@ -413,6 +732,343 @@ private:
   std::size_t next_state_id_;
 };
 
+#if defined(__GNUC__)
+#define METAHSM_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define METAHSM_NOINLINE __declspec(noinline)
+#else
+#define METAHSM_NOINLINE
+#endif
+
+// Relative layout of the sub-machine of a shared-body state. Node 0 is the
+// state itself, node j > 0 its descendant with state id offset + j - 1: in
+// all_states_t, the descendants of a state form one block, its children first.
+struct SharedNode
+{
+  std::uint8_t children;          // first child; the descendants start there too
+  std::uint8_t child_count;
+  std::uint8_t descendant_count;
+  std::uint8_t initial;
+};
+
+using SharedHook = void (*)(StateImplBase&);
+using SharedReact = bool (*)(StateImplBase&, StateMachineBase&, const void*);
+
+// Everything the shared engine knows of one instantiation: a table per
+// instantiation rather than code.
+struct SharedLayout
+{
+  std::uint64_t self;
+  std::size_t offset;
+  SharedNode const* nodes;
+  SharedHook const* entries;      // on_entry() per node, null if none
+  SharedHook const* exits;        // on_exit() per node, null if none
+  std::string_view const* names;  // state names of the machine, when tracing
+};
+
+// Storage of one node in a machine.
+struct SharedSlot
+{
+  StateImplBase* state;
+  std::uint64_t* last;
+  std::uint64_t* last_recursive;
+};
+
+// The enter, exit and event walks of every shared-body sub-machine, with the
+// semantics of the nested Composite and SimpleStateWrappers it replaces. The
+// active child of a node is its `last`, unless the node's sub-states were
+// exited and pending_ names it.
+class SharedBody
+{
+public:
+  METAHSM_NOINLINE void start(SharedLayout const& layout, SharedSlot const* slots, std::uint64_t target) {
+    pending_ = 0;
+    next_ = static_cast<std::uint8_t>(next_sub_state(layout, 0, target));
+    enter_from(layout, slots, 0, target);
+  }
+
+  METAHSM_NOINLINE void stop(SharedLayout const& layout, SharedSlot const* slots) {
+    exit_below(layout, slots, 0);
+  }
+
+  METAHSM_NOINLINE void exit(SharedLayout const& layout, SharedSlot const* slots, std::uint64_t target) {
+    exit_from(layout, slots, 0, target);
+  }
+
+  METAHSM_NOINLINE void enter(SharedLayout const& layout, SharedSlot const* slots, std::uint64_t target) {
+    enter_from(layout, slots, 0, target);
+  }
+
+  // Innermost active state first, up to but excluding node 0, whose own
+  // reaction stays with its wrapper. reacts holds one thunk per node.
+  METAHSM_NOINLINE bool react(SharedLayout const& layout, SharedSlot const* slots, SharedReact const* reacts,
+      StateMachineBase & state_machine, const void* event) {
+    return react_from(layout, slots, reacts, state_machine, 0, event);
+  }
+
+private:
+  static constexpr std::uint8_t none = 0xff;
+
+  static std::uint64_t bit(SharedLayout const& layout, std::size_t node) {
+    return node ? std::uint64_t{1} << (layout.offset + node - 1) : layout.self;
+  }
+
+  static std::uint64_t block(SharedLayout const& layout, std::size_t first, std::size_t count) {
+    return count ? (~std::uint64_t{0} >> (64 - count)) << (layout.offset + first - 1) : 0;
+  }
+
+  static std::size_t node_of(SharedLayout const& layout, std::uint64_t bit) {
+    return bit_index(bit) - layout.offset + 1;
+  }
+
+  static std::size_t next_sub_state(SharedLayout const& layout, std::size_t node, std::uint64_t target) {
+    SharedNode const& n = layout.nodes[node];
+    const std::uint64_t targeted = target & block(layout, n.children, n.child_count);
+    return targeted ? node_of(layout, targeted) : n.initial;
+  }
+
+  bool has_active_child(SharedLayout const& layout, std::size_t node) const {
+    return layout.nodes[node].child_count && pending_ != node;
+  }
+
+  static std::size_t active_child(SharedLayout const& layout, SharedSlot const* slots, std::size_t node) {
+    return node_of(layout, *slots[node].last);
+  }
+
+  static void enter_state(SharedLayout const& layout, SharedSlot const* slots, std::size_t node) {
+#if METAHSM_TRACE
+    trace_enter(layout.names[layout.offset + node - 1]);
+#endif
+    if(layout.entries[node]) {
+      layout.entries[node](*slots[node].state);
+    }
+  }
+
+  static void exit_state(SharedLayout const& layout, SharedSlot const* slots, std::size_t node) {
+#if METAHSM_TRACE
+    trace_exit(layout.names[layout.offset + node - 1]);
+#endif
+    if(layout.exits[node]) {
+      layout.exits[node](*slots[node].state);
+    }
+  }
+
+  void enter_node(SharedLayout const& layout, SharedSlot const* slots, std::size_t node, std::uint64_t target) {
+    enter_state(layout, slots, node);
+    if(!layout.nodes[node].child_count) {
+      *slots[node].last_recursive = bit(layout, node);
+      return;
+    }
+    const std::size_t child = next_sub_state(layout, node, target);
+    enter_node(layout, slots, child, target);
+    *slots[node].last_recursive = bit(layout, node) | *slots[child].last_recursive;
+    *slots[node].last = bit(layout, child);
+  }
+
+  void enter_from(SharedLayout const& layout, SharedSlot const* slots, std::size_t node, std::uint64_t target) {
+    if(pending_ == node) {
+      const std::size_t child = next_;
+      pending_ = none;
+      enter_node(layout, slots, child, target);
+      *slots[node].last_recursive = bit(layout, node) | *slots[child].last_recursive;
+      *slots[node].last = bit(layout, child);
+    }
+    else if(layout.nodes[node].child_count) {
+      const std::size_t child = active_child(layout, slots, node);
+      enter_from(layout, slots, child, target);
+      *slots[node].last_recursive = bit(layout, node) | *slots[child].last_recursive;
+    }
+  }
+
+  void exit_below(SharedLayout const& layout, SharedSlot const* slots, std::size_t node) {
+    if(has_active_child(layout, node)) {
+      const std::size_t child = active_child(layout, slots, node);
+      exit_below(layout, slots, child);
+      exit_state(layout, slots, child);
+    }
+  }
+
+  // See sub_state_exit(): keep the sub-states, walk into the active one, or
+  // exit them all and pick the sub-state to enter next.
+  void exit_from(SharedLayout const& layout, SharedSlot const* slots, std::size_t node, std::uint64_t target) {
+    SharedNode const& n = layout.nodes[node];
+    if(!n.child_count || !(target & (bit(layout, node) | block(layout, n.children, n.descendant_count)))) {
+      return;
+    }
+    if(target & *slots[node].last_recursive & ~bit(layout, node)) {
+      if(has_active_child(layout, node)) {
+        exit_from(layout, slots, active_child(layout, slots, node), target);
+      }
+      return;
+    }
+    exit_below(layout, slots, node);
+    pending_ = static_cast<std::uint8_t>(node);
+    next_ = static_cast<std::uint8_t>(next_sub_state(layout, node, target));
+  }
+
+  bool react_from(SharedLayout const& layout, SharedSlot const* slots, SharedReact const* reacts,
+      StateMachineBase & state_machine, std::size_t node, const void* event) {
+    if(has_active_child(layout, node)
+        && react_from(layout, slots, reacts, state_machine, active_child(layout, slots, node), event)) {
+      return true;
+    }
+    return node && reacts[node] && reacts[node](*slots[node].state, state_machine, event);
+  }
+
+  std::uint8_t pending_ = none;
+  std::uint8_t next_ = 0;
+};
+
+template <typename Event_, typename ... State_>
+constexpr bool any_reacts(type_identity<std::tuple<State_...>>) {
+  return (StateWrapper<State_>::template has_react<Event_> || ...);
+}
+
+// Wrapper of a composite state declaring `static constexpr bool shared_body =
+// true;`, typically in a StateTemplate instantiated many times. Its sub-states
+// get no wrappers: the SharedBody engine, one copy for all machines, walks
+// them through a constexpr SharedLayout per instantiation and the SharedSlots
+// of this machine. What remains per instantiation are this shim and the calls
+// into user code: on_entry(), on_exit() and react() thunks. The sub-machine
+// may not contain orthogonal states.
+template <typename State_>
+class SharedCompositeWrapper : public StateWrapper<State_>
+{
+public:
+  using TopState = top_state_t<State_>;
+  using States = all_states_t<State_>;
+  using typename StateWrapper<State_>::StateMachine;
+  static constexpr std::size_t N = std::tuple_size_v<States>;
+  template <typename Event_>
+  static constexpr bool HAS_REACT_RECURSIVE = any_reacts<Event_>(type_identity<States>{});
+
+  SharedCompositeWrapper(WrapperArgs<State_> args)
+  : StateWrapper<State_>(args),
+    slots_{make_slots(args.state_machine, type_identity<States>{})}
+  {
+    body_.start(layout, slots_.data(), args.target);
+  }
+
+  ~SharedCompositeWrapper() {
+    body_.stop(layout, slots_.data());
+  }
+
+  template <typename Event_>
+  bool handle_event(const Event_& e) {
+    bool reacted = false;
+    if constexpr(any_reacts<Event_>(type_identity<contained_states_recursive_t<State_>>{})) {
+      reacted = body_.react(layout, slots_.data(), reacts<Event_>.data(), this->state_machine_, &e);
+    }
+    if constexpr(StateWrapper<State_>::template has_react<Event_>) {
+      return reacted || this->StateWrapper<State_>::handle_event(e);
+    }
+    else {
+      return reacted;
+    }
+  }
+
+  void exit(state_combination_t<TopState> const& target) {
+    body_.exit(layout, slots_.data(), target);
+  }
+
+  void enter(state_combination_t<TopState> const& target) {
+    body_.enter(layout, slots_.data(), target);
+  }
+
+private:
+  static constexpr std::size_t offset = state_id_v<std::tuple_element_t<0, contained_states_recursive_t<State_>>>;
+
+  template <typename Node_>
+  static constexpr std::size_t node_v = std::is_same_v<Node_, State_> ? 0 : state_id_v<Node_> - offset + 1;
+
+  template <typename ... Node_>
+  static constexpr bool is_contiguous(type_identity<std::tuple<State_, Node_...>>) {
+    std::size_t expected = 1;
+    return ((node_v<Node_> == expected++) && ...);
+  }
+
+  static_assert(!(is_orthogonal_state<State_>::value) && std::tuple_size_v<orthogonal_states_t<States>> == 0,
+      "a shared-body sub-machine may not contain orthogonal states");
+  static_assert(is_contiguous(type_identity<States>{}), "descendants of a shared-body state must have consecutive ids");
+
+  template <typename Node_>
+  static constexpr SharedNode node() {
+    if constexpr(std::is_same_v<base_t<Node_>, SimpleStateBase>) {
+      return {0, 0, 0, 0};
+    }
+    else {
+      using Children = contained_states_direct_t<Node_>;
+      return {static_cast<std::uint8_t>(node_v<std::tuple_element_t<0, Children>>),
+          static_cast<std::uint8_t>(std::tuple_size_v<Children>),
+          static_cast<std::uint8_t>(std::tuple_size_v<contained_states_recursive_t<Node_>>),
+          static_cast<std::uint8_t>(node_v<initial_state_t<Node_>>)};
+    }
+  }
+
+  template <typename Node_>
+  static void on_entry(StateImplBase & state) {
+    static_cast<StateMixin<Node_>&>(state).on_entry();
+  }
+
+  template <typename Node_>
+  static void on_exit(StateImplBase & state) {
+    static_cast<StateMixin<Node_>&>(state).on_exit();
+  }
+
+  template <typename Node_, typename Event_>
+  static bool react(StateImplBase & state, StateMachineBase & state_machine, const void* event) {
+    return StateWrapper<Node_>::react_to(static_cast<StateMixin<Node_>&>(state),
+        static_cast<StateMachine&>(state_machine), *static_cast<const Event_*>(event));
+  }
+
+  template <typename ... Node_>
+  static constexpr std::array<SharedNode, N> make_nodes(type_identity<std::tuple<Node_...>>) {
+    return {node<Node_>()...};
+  }
+
+  template <typename ... Node_>
+  static constexpr std::array<SharedHook, N> make_entries(type_identity<std::tuple<Node_...>>) {
+    return {(!std::is_same_v<Node_, State_> && has_on_entry_v<Node_> ? &on_entry<Node_> : nullptr)...};
+  }
+
+  template <typename ... Node_>
+  static constexpr std::array<SharedHook, N> make_exits(type_identity<std::tuple<Node_...>>) {
+    return {(!std::is_same_v<Node_, State_> && has_on_exit_v<Node_> ? &on_exit<Node_> : nullptr)...};
+  }
+
+  template <typename Event_, typename ... Node_>
+  static constexpr std::array<SharedReact, N> make_reacts(type_identity<std::tuple<Node_...>>) {
+    return {(!std::is_same_v<Node_, State_> && StateWrapper<Node_>::template has_react<Event_> ? &react<Node_, Event_> : nullptr)...};
+  }
+
+  template <typename ... Node_>
+  static std::array<SharedSlot, N> make_slots(StateMachine & state_machine, type_identity<std::tuple<Node_...>>) {
+    return {slot(state_machine.template get_state<Node_>())...};
+  }
+
+  template <typename Mixin_>
+  static SharedSlot slot(Mixin_ & mixin) {
+    return {&mixin, &mixin.last, &mixin.last_recursive};
+  }
+
+  static constexpr std::array<SharedNode, N> nodes = make_nodes(type_identity<States>{});
+  static constexpr std::array<SharedHook, N> entries = make_entries(type_identity<States>{});
+  static constexpr std::array<SharedHook, N> exits = make_exits(type_identity<States>{});
+  template <typename Event_>
+  static constexpr std::array<SharedReact, N> reacts = make_reacts<Event_>(type_identity<States>{});
+
+  static constexpr SharedLayout layout{state_combination_v<State_>, offset, nodes.data(), entries.data(), exits.data(),
+#if METAHSM_TRACE
+      state_names<TopState>.data()
+#else
+      nullptr
+#endif
+  };
+
+  std::array<SharedSlot, N> slots_;
+  SharedBody body_;
+};
+
 template <typename State_>
 class OrthogonalStateWrapper : public StateWrapper<State_>
 {
@@ -498,14 +1154,289 @@ private:
 //                                         STATE MACHINE                                               //
 //=====================================================================================================//
 
+// Requests of the current step, kept when the top state has a ConflictPolicy.
+template <typename TopState_, typename Policy_ = conflict_policy_t<TopState_>>
+struct ConflictResolution
+{
+  using sc_t = state_combination_t<TopState_>;
+  static constexpr std::size_t capacity = std::tuple_size_v<all_states_t<TopState_>>;
+  struct Request
+  {
+    sc_t branch;
+    sc_t source;
+    int rank;
+  };
+  std::array<Request, capacity> requests{};
+  std::size_t count = 0;
+  std::size_t action_owner = capacity;
+  sc_t candidate = 0;
+  TransitionAction action;
+  ConflictReport<sc_t> report{};
+};
+
+template <typename TopState_>
+struct ConflictResolution<TopState_, void>
+{};
+
+template <typename StateCombination_>
+struct StateHistory
+{
+  StateCombination_ last;
+  StateCombination_ last_recursive;
+};
+
+// Configuration of a machine as of its last completed dispatch(), for readers
+// on other threads. Enabled by `static constexpr bool publish_configuration = true;`
+// on the top state. The configuration word is a single atomic; the history of
+// all states is published under a seqlock, so readers retry instead of ever
+// blocking the dispatching thread. Until the machine starts, readers see no
+// active state and epoch 0. Needs METAHSM_HOSTED.
+template <typename TopState_, bool = publishes_configuration_v<TopState_>>
+class PublishedConfiguration;
+
+#if METAHSM_HOSTED
+template <typename TopState_>
+class PublishedConfiguration<TopState_, true>
+{
+public:
+  using sc_t = state_combination_t<TopState_>;
+  static constexpr std::size_t N = std::tuple_size_v<all_states_t<TopState_>>;
+
+  sc_t active_states() const {
+    return active_.load(std::memory_order_acquire);
+  }
+
+  // See StateMachine::epoch(). Readers can skip machines whose epoch they have seen.
+  std::uint64_t epoch() const {
+    return epoch_.load(std::memory_order_acquire);
+  }
+
+  template <typename State_>
+  bool is_in_state() const {
+    return active_states() & state_combination_v<State_>;
+  }
+
+  // last and last_recursive of State_, both from the same dispatch().
+  template <typename State_>
+  StateHistory<sc_t> history() const {
+    constexpr std::size_t id = state_id_v<State_>;
+    StateHistory<sc_t> result;
+    std::uint32_t begin, end;
+    do {
+      begin = sequence_.load(std::memory_order_acquire);
+      result.last = last_[id].load(std::memory_order_relaxed);
+      result.last_recursive = last_recursive_[id].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      end = sequence_.load(std::memory_order_relaxed);
+    } while((begin & 1) || begin != end);
+    return result;
+  }
+
+  // internal, called by the dispatching thread only
+  void begin_write() {
+    sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void write(std::size_t id, sc_t last, sc_t last_recursive) {
+    last_[id].store(last, std::memory_order_relaxed);
+    last_recursive_[id].store(last_recursive, std::memory_order_relaxed);
+  }
+
+  void end_write(sc_t active, std::uint64_t epoch) {
+    active_.store(active, std::memory_order_release);
+    epoch_.store(epoch, std::memory_order_release);
+    sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+private:
+  std::atomic<sc_t> active_{0};
+  std::atomic<std::uint64_t> epoch_{0};
+  std::atomic<std::uint32_t> sequence_{0};
+  std::array<std::atomic<sc_t>, N> last_{};
+  std::array<std::atomic<sc_t>, N> last_recursive_{};
+};
+#endif
+
+template <typename TopState_>
+class PublishedConfiguration<TopState_, false>
+{};
+
+// Slot of a ResidentRegion the machine mirrors itself into, if attached.
+// Needs METAHSM_HOSTED.
+template <typename TopState_, bool = resident_configuration_v<TopState_>>
+struct ResidentMirror;
+
+#if METAHSM_HOSTED
+template <typename TopState_>
+struct ResidentMirror<TopState_, true>
+{
+  ResidentSlot slot;
+};
+#endif
+
+template <typename TopState_>
+struct ResidentMirror<TopState_, false>
+{};
+
+// Change of the configuration, delivered to the subscribers whose masks it
+// matches. tag is the one given to subscribe().
+template <typename StateCombination_>
+struct Notification
+{
+  std::uint32_t tag;
+  std::uint64_t epoch;
+  StateCombination_ entered;
+  StateCombination_ exited;
+};
+
+// Subscribers to configuration changes, up to `static constexpr std::size_t
+// max_subscribers` declared on the top state. Each subscriber owns a
+// single-consumer channel (e.g. SpscChannel) that only the dispatching thread
+// pushes to, so the fan-out never locks. The union of all masks is checked
+// first, so machines nobody listens to pay a single AND per change.
+template <typename TopState_, std::size_t Capacity_ = max_subscribers_v<TopState_>>
+class Subscriptions
+{
+public:
+  using sc_t = state_combination_t<TopState_>;
+  using Push = bool (*)(void*, Notification<sc_t> const&);
+
+  bool add(sc_t entry, sc_t exit, std::uint32_t tag, void* channel, Push push) {
+    if(count_ == Capacity_) {
+      return false;
+    }
+    subscribers_[count_++] = {entry, exit, tag, channel, push};
+    interest_ |= entry | exit;
+    return true;
+  }
+
+  bool remove(void* channel) {
+    bool removed = false;
+    interest_ = 0;
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < count_; i++) {
+      if(subscribers_[i].channel == channel) {
+        removed = true;
+        continue;
+      }
+      interest_ |= subscribers_[i].entry | subscribers_[i].exit;
+      subscribers_[kept++] = subscribers_[i];
+    }
+    count_ = kept;
+    return removed;
+  }
+
+  // Configurations are compared as a whole, so states exited and entered
+  // again within one dispatch() are not reported.
+  void notify(std::uint64_t epoch, sc_t active) {
+    const sc_t changed = active ^ active_;
+    const sc_t exited = changed & active_;
+    active_ = active;
+    if(!(changed & interest_)) {
+      return;
+    }
+    const Notification<sc_t> notification{0, epoch, changed & active, exited};
+    for(std::size_t i = 0; i < count_; i++) {
+      auto const& subscriber = subscribers_[i];
+      if((notification.entered & subscriber.entry) | (exited & subscriber.exit)) {
+        auto tagged = notification;
+        tagged.tag = subscriber.tag;
+        if(!subscriber.push(subscriber.channel, tagged)) {
+          dropped_++;
+        }
+      }
+    }
+  }
+
+  // Notifications lost to full channels, over all subscribers.
+  std::size_t dropped() const {
+    return dropped_;
+  }
+
+private:
+  struct Subscriber
+  {
+    sc_t entry;
+    sc_t exit;
+    std::uint32_t tag;
+    void* channel;
+    Push push;
+  };
+
+  std::array<Subscriber, Capacity_> subscribers_{};
+  std::size_t count_{0};
+  std::size_t dropped_{0};
+  sc_t interest_{0};
+  sc_t active_{0};
+};
+
+template <typename TopState_>
+class Subscriptions<TopState_, 0>
+{
+public:
+  void notify(std::uint64_t, state_combination_t<TopState_>) {}
+  std::size_t dropped() const { return 0; }
+};
+
+// Events dispatched while a transition with an asynchronous action is in
+// progress, queued until poll() completes it. Holds up to `static constexpr
+// std::size_t max_deferred_events` declared on the top state; without it,
+// such events are rejected and the machine keeps no queue.
+template <typename TopState_, std::size_t Capacity_ = max_deferred_events_v<TopState_>>
+class DeferredEvents;
+
+#if METAHSM_HOSTED
+template <typename TopState_, std::size_t Capacity_>
+class DeferredEvents
+{
+public:
+  bool push(InplaceFunction<void()> && event) {
+    if(count_ == Capacity_) {
+      return false;
+    }
+    events_[(head_ + count_++) % Capacity_] = std::move(event);
+    return true;
+  }
+
+  InplaceFunction<void()> pop() {
+    InplaceFunction<void()> event = std::move(events_[head_]);
+    head_ = (head_ + 1) % Capacity_;
+    count_--;
+    return event;
+  }
+
+  bool empty() const {
+    return count_ == 0;
+  }
+
+private:
+  std::array<InplaceFunction<void()>, Capacity_> events_;
+  std::size_t head_{0};
+  std::size_t count_{0};
+};
+
+#endif
+
+template <typename TopState_>
+class DeferredEvents<TopState_, 0>
+{
+public:
+  TransitionAction pop() { return {}; }
+  bool empty() const { return true; }
+};
+
 template <typename Mixin_>
 struct MixinHolder
 {
-  using StateMachine = StateMachine<typename Mixin_::TopState>;
+  using StateMachine = metahsm::StateMachine<typename Mixin_::TopState>;
 
-  MixinHolder(StateMachine & state_machine)
-  : mixin{{{{.state_machine_ = state_machine}}}}
-  {}
+  // Value-initializes the state whatever its depth of bases, then binds it.
+  constexpr MixinHolder(StateMachine & state_machine)
+  : mixin{}
+  {
+    mixin.state_machine_ = &state_machine;
+  }
 
   Mixin_ mixin;
 };
@@ -515,67 +1446,326 @@ class StateMachine : public StateMachineBase
 {
 public:
   using States = all_states_t<TopState_>;
-  using StateMixins = tuple_apply_t<MixinHolder, tuple_apply_t<StateMixin, States>>;
+  using StateMixins = tuple_apply_t<MixinHolder, tuple_apply_t<StateMixin, storage_order_t<TopState_>>>;
+  using ColdStateMixins = tuple_apply_t<MixinHolder, tuple_apply_t<StateMixin, cold_states_t<TopState_>>>;
   using sc_t = state_combination_t<TopState_>;
   static constexpr std::size_t N = std::tuple_size_v<States>;
+  static constexpr bool resolves_conflicts = !std::is_void_v<conflict_policy_t<TopState_>>;
+  static_assert(is_transition_table_valid<TopState_>::value, "transition table rows must leave from and target states of this machine");
+#if !METAHSM_HOSTED
+  static_assert(!publishes_configuration_v<TopState_> && !resident_configuration_v<TopState_> && max_deferred_events_v<TopState_> == 0,
+      "published and resident configurations and deferred events need METAHSM_HOSTED");
+#endif
+  static_assert(std::tuple_size_v<storage_order_t<TopState_>> + std::tuple_size_v<cold_states_t<TopState_>> == N
+      && !tuple_contains_v<TopState_, cold_states_t<TopState_>>,
+      "HotStates and ColdStates must be distinct states of this machine, and the top state is never cold");
 
   StateMachine()
-  : all_states_{init_states(type_identity<States>{})},
-    active_state_configuration_{WrapperArgs<TopState_>{get_state<TopState_>(), *this, {}}},
+  : StateMachine(deferred_start)
+  {
+    start();
+  }
+
+  // Constant-initializable machine (e.g. constinit): the storage comes up with
+  // the initial configuration, but no state has been entered yet. The machine
+  // starts on start() or on the first dispatch(), whichever comes first; the
+  // on_entry() of the initial configuration runs then, before the event.
+  constexpr explicit StateMachine(deferred_start_t)
+  : all_states_{init_states<StateMixins>(type_identity<storage_order_t<TopState_>>{})},
     target_branch_{0},
     target_{0}
-  { }
+  {
+    get_state<TopState_>().last_recursive = state_combination(type_identity<initial_configuration_t<TopState_>>{});
+  }
+
+  // Enters the initial configuration. Does nothing if already started.
+  void start() {
+    if(!active_state_configuration_) {
+      active_state_configuration_.emplace(WrapperArgs<TopState_>{get_state<TopState_>(), *this, {}});
+      run_to_completion(true);
+      configuration_changed();
+    }
+  }
+
+  bool is_started() const {
+    return active_state_configuration_.has_value();
+  }
 
   // TODO copy, move ctor
 
+  // Returns whether any state reacted to the event. While a transition with an
+  // asynchronous action is in progress, the event is queued until poll()
+  // completes the transition instead (see DeferredEvents), and the result
+  // tells whether it fit.
   template <typename Event_>
   bool dispatch(const Event_& event = {}) {
-    trace_event<Event_>();
-    bool reacted = active_state_configuration_.handle_event(event);
-    active_state_configuration_.exit(target_branch_);
-    execute_actions();
-    active_state_configuration_.enter(target_branch_);
-    target_ = 0;
-    target_branch_ = 0;
+    if(this->pending_) {
+      return defer(event);
+    }
+    if(!active_state_configuration_) {
+      start();
+    }
+    const std::uint64_t epoch = epoch_;
+    const bool reacted = handle<true>(event);
+    if constexpr(!std::is_void_v<resident_data_t<TopState_>>) {
+      if(reacted && epoch == epoch_) {
+        write_resident();
+      }
+    }
+    return reacted;
+  }
+
+  // Same as calling dispatch() for each event in order, except that the
+  // start-up check runs once, and the configuration is published to other
+  // threads and mirrored into a ResidentSlot once, after the last event.
+  // Subscribers are still notified of every change. results, if given,
+  // receives one entry per event. Returns the number of events reacted to.
+  template <typename ... Event_>
+  std::size_t dispatch_batch(const std::variant<Event_...>* events, std::size_t count, bool* results = nullptr) {
+    if(!active_state_configuration_ && !this->pending_) {
+      start();
+    }
+    auto do_dispatch = [this](auto const& event) {
+      if(this->pending_) {
+        return defer(event);
+      }
+      return handle<false>(event);
+    };
+    const std::uint64_t epoch = epoch_;
+    std::size_t reacted = 0;
+    for(std::size_t i = 0; i < count; i++) {
+      const bool result = visit(do_dispatch, events[i]);
+      reacted += result;
+      if(results) {
+        results[i] = result;
+      }
+    }
+    if(epoch != epoch_) {
+      mirror();
+    }
+    else if constexpr(!std::is_void_v<resident_data_t<TopState_>>) {
+      if(reacted) {
+        write_resident();
+      }
+    }
     return reacted;
   }
 
+  template <typename ... Event_, std::size_t N_>
+  std::size_t dispatch_batch(const std::variant<Event_...> (&events)[N_], bool* results = nullptr) {
+    return dispatch_batch(events, N_, results);
+  }
+
+#if METAHSM_HOSTED && defined(__cpp_lib_span)
+  template <typename Variant_, std::size_t Extent_>
+  std::size_t dispatch_batch(std::span<Variant_, Extent_> events, std::span<bool> results = {}) {
+    return dispatch_batch(events.data(), events.size(), results.empty() ? nullptr : results.data());
+  }
+#endif
+
+#if METAHSM_HOSTED
+  // Dispatches a wire frame (see wire.hpp) to the event of TopState_::WireEvents
+  // with the matching wire id. The states react to the event in place in the
+  // frame; only frames whose payload is misaligned are copied first.
+  // Returns WireStatus::rejected for unknown ids and size mismatches.
+  WireStatus dispatch_bytes(const std::byte* frame, std::size_t size) {
+    using Events = wire_events_t<TopState_>;
+    if constexpr(std::tuple_size_v<Events> == 0) {
+      return WireStatus::rejected;
+    }
+    else {
+      constexpr auto& hash = wire_hash_v<Events>;
+      if (size < wire_header_size) {
+        return WireStatus::rejected;
+      }
+      std::uint16_t id;
+      std::memcpy(&id, frame, sizeof(id));
+      const std::size_t handler = hash.find(id);
+      if (handler == hash.empty) {
+        return WireStatus::rejected;
+      }
+      return dispatch_wire(handler, frame, size, type_identity<Events>{});
+    }
+  }
+
+#if defined(__cpp_lib_span)
+  WireStatus dispatch_bytes(std::span<const std::byte> frame) {
+    return dispatch_bytes(frame.data(), frame.size());
+  }
+#endif
+#endif
+
+  // Continuation of a transition with an asynchronous action, called by the
+  // executor driving this machine. Once the action has completed, enters the
+  // target configuration and dispatches the events deferred in the meantime.
+  // Returns true if the transition completed in this call. If the action
+  // completed with an exception, the transition completes all the same and
+  // poll() then rethrows the exception.
+  bool poll() {
+    if(!this->pending_) {
+      return false;
+    }
+#if defined(__cpp_exceptions)
+    std::exception_ptr failure;
+    try {
+      if(!this->pending_()) {
+        return false;
+      }
+    }
+    catch(...) {
+      failure = std::current_exception();
+    }
+#else
+    if(!this->pending_()) {
+      return false;
+    }
+#endif
+    this->pending_.reset();
+    run_to_completion(enter_target());
+    configuration_changed();
+    while(!deferred_.empty() && !this->pending_) {
+      deferred_.pop()();
+    }
+#if defined(__cpp_exceptions)
+    if(failure) {
+      std::rethrow_exception(failure);
+    }
+#endif
+    return true;
+  }
+
   template <typename State_>
-  auto& get_state() {
-    return std::get<MixinHolder<StateMixin<State_>>>(all_states_).mixin;
+  constexpr auto& get_state() {
+    if constexpr(tuple_contains_v<State_, cold_states_t<TopState_>>) {
+      return std::get<MixinHolder<StateMixin<State_>>>(cold_states_).mixin;
+    }
+    else {
+      return std::get<MixinHolder<StateMixin<State_>>>(all_states_).mixin;
+    }
   }
 
   template <typename State_>
   bool is_in_state() {
-    return (active_state_configuration_.state().last_recursive & state_combination_v<State_>);
+    return (get_state<TopState_>().last_recursive & state_combination_v<State_>);
+  }
+
+  sc_t active_states() {
+    return get_state<TopState_>().last_recursive;
+  }
+
+  // Whether some active state reacts to Event_.
+  template <typename Event_>
+  bool handles() {
+    return active_states() & handler_mask_v<TopState_, Event_>;
+  }
+
+  // Number of dispatch() calls (and start(), poll()) that executed a
+  // transition so far. Unchanged epoch, unchanged configuration.
+  std::uint64_t epoch() const {
+    return epoch_;
+  }
+
+  // False if the last dispatch() (or start(), poll()) gave up on completion
+  // events after max_completion_steps_v steps with a transition still taken in
+  // the last one, so the configuration may not be stable.
+  bool is_stable() const {
+    return stable_;
+  }
+
+  // After each change entering one of the states in Entry_ or exiting one of
+  // those in Exit_ (a state or a tuple of states), pushes a Notification
+  // tagged with tag to channel. channel.push() is called on the dispatching
+  // thread. Returns false if max_subscribers are already subscribed.
+  template <typename Entry_, typename Exit_ = std::tuple<>, typename Channel_>
+  bool subscribe(Channel_ & channel, std::uint32_t tag = 0) {
+    static_assert(max_subscribers_v<TopState_> > 0, "the top state does not declare max_subscribers");
+    return subscriptions_.add(state_combination_v<Entry_>, state_combination_v<Exit_>, tag, &channel,
+        [](void* target, Notification<sc_t> const& notification) {
+          return static_cast<Channel_*>(target)->push(notification);
+        });
+  }
+
+  template <typename Channel_>
+  bool unsubscribe(Channel_ & channel) {
+    return subscriptions_.remove(&channel);
+  }
+
+  // Notifications not delivered because the channel's push() failed, since
+  // the machine was constructed. The subscriber has missed changes and should
+  // resynchronize from active_states().
+  std::size_t dropped_notifications() const {
+    return subscriptions_.dropped();
+  }
+
+  // The configuration published for other threads, with the same queries.
+  // Requires publish_configuration on the top state.
+  template <typename TopState__ = TopState_>
+  PublishedConfiguration<TopState_> const& published() const {
+    static_assert(publishes_configuration_v<TopState__>, "the top state does not publish its configuration");
+    return published_;
+  }
+
+#if METAHSM_HOSTED
+  // Mirrors this machine into slot, from now on and once right away. Requires
+  // resident_configuration on the top state; see resident.hpp.
+  template <typename TopState__ = TopState_>
+  void attach(ResidentSlot slot) {
+    static_assert(resident_configuration_v<TopState__>, "the top state does not declare resident_configuration");
+    resident_.slot = slot;
+    write_resident();
+  }
+#endif
+
+  // Conflicts between the transitions requested during the last dispatch().
+  // Only kept when the top state declares a ConflictPolicy.
+  template <typename TopState__ = TopState_>
+  ConflictReport<sc_t> const& conflict_report() const {
+    static_assert(!std::is_void_v<conflict_policy_t<TopState__>>, "the top state has no ConflictPolicy");
+    return conflicts_.report;
   }
 
   template <typename State_>
   void post_react(bool result) {
+    if constexpr(resolves_conflicts) {
+      resolve<State_>();
+    }
     trace_react<State_>(result, target_);
     target_ = 0;
   }
 
 private:
   StateMixins all_states_;
-  wrapper_t<TopState_> active_state_configuration_;
+  std::optional<wrapper_t<TopState_>> active_state_configuration_;
   sc_t target_branch_;
   sc_t target_;
+  DeferredEvents<TopState_> deferred_{};
+  ConflictResolution<TopState_> conflicts_{};
+  PublishedConfiguration<TopState_> published_{};
+  Subscriptions<TopState_> subscriptions_{};
+  ResidentMirror<TopState_> resident_{};
+  std::uint64_t epoch_{0};
+  bool stable_{true};
+  // out of line: the members above stay close to the hot state storage
+  ColdStateMixins cold_states_{init_states<ColdStateMixins>(type_identity<cold_states_t<TopState_>>{})};
 
   friend class StateImplBase;
+  template <typename>
+  friend class StateWrapper;
 
   template <typename>
-  auto& sm() {
+  constexpr auto& sm() {
     return *this;
   }
 
-  template <typename ... State_>
-  auto init_states(type_identity<std::tuple<State_...>>) {
-    return StateMixins{sm<State_>()...};
+  template <typename Mixins_, typename ... State_>
+  constexpr Mixins_ init_states(type_identity<std::tuple<State_...>>) {
+    return Mixins_{sm<State_>()...};
   }
 
   template <typename Target_>
   bool transition() {
+    static_assert(tuple_contains_v<target_state_t<Target_>, States>,
+        "transition target was pruned as unreachable: list it in the Targets of the source state");
     if constexpr(std::is_base_of_v<HistoryBase, Target_>) {
       using TargetState_ = typename Target_::State;
       if constexpr(std::is_base_of_v<DeepHistoryBase, Target_>) {
@@ -590,21 +1780,244 @@ private:
     }
   }
 
+  // The masks are compile-time constants, and the validity check only covers
+  // the regions the target branch can conflict in; only the history is read at
+  // run time. With a ConflictPolicy, the requests of the reacting state are
+  // collected here and resolved in post_react().
   template <typename TargetState_>
   bool transition(sc_t const& history) {
-    sc_t new_target = state_combination_v<TargetState_>;
-    sc_t new_target_branch = new_target | history | state_combination_v<super_state_recursive_t<TargetState_>>;
-    bool valid = is_valid<TopState_>(target_branch_, new_target_branch);
+    constexpr sc_t new_target = state_combination_v<TargetState_>;
+    const sc_t new_target_branch = new_target | history | state_combination_v<super_state_recursive_t<TargetState_>>;
+    sc_t& branch = select_branch();
+    const bool valid = is_valid_transition<TopState_, TargetState_>(branch, new_target_branch);
     if(valid) {
-      target_branch_ |= new_target_branch;
+      branch |= new_target_branch;
       target_ |= new_target;
     }
     return valid;
   }
 
+  // dispatch() of a started machine. Mirror_ publishes changes right away;
+  // dispatch_batch() calls mirror() once instead.
+  template <bool Mirror_, typename Event_>
+  bool handle(const Event_& event) {
+    if constexpr(resolves_conflicts) {
+      conflicts_.report = {};
+    }
+    trace_event<Event_>();
+    const bool reacted = active_state_configuration_->handle_event(event);
+    const bool entered = execute_transition();
+    run_to_completion(entered);
+    if(entered) {
+      configuration_changed<Mirror_>();
+    }
+    return reacted;
+  }
+
+  template <bool Mirror_ = true>
+  void configuration_changed() {
+    epoch_++;
+    if constexpr(Mirror_) {
+      mirror();
+    }
+    subscriptions_.notify(epoch_, active_states());
+  }
+
+  void mirror() {
+    publish();
+    write_resident();
+  }
+
+  void publish() {
+    if constexpr(publishes_configuration_v<TopState_>) {
+      publish(type_identity<States>{});
+    }
+  }
+
+  void write_resident() {
+    if constexpr(resident_configuration_v<TopState_>) {
+      if(resident_.slot) {
+        write_resident(type_identity<States>{});
+      }
+    }
+  }
+
+#if METAHSM_HOSTED
+  template <typename ... State_>
+  void write_resident(type_identity<std::tuple<State_...>>) {
+    ResidentSlot& slot = resident_.slot;
+    slot.begin_write();
+    (slot.write(state_id_v<State_>, get_state<State_>().last, get_state<State_>().last_recursive), ...);
+    if constexpr(!std::is_void_v<resident_data_t<TopState_>>) {
+      const resident_data_t<TopState_> data = get_state<TopState_>().resident_data();
+      slot.write_data(&data, sizeof(data));
+    }
+    slot.end_write(get_state<TopState_>().last_recursive, epoch_);
+  }
+#endif
+
+  template <typename ... State_>
+  void publish(type_identity<std::tuple<State_...>>) {
+    published_.begin_write();
+    (published_.write(state_id_v<State_>, get_state<State_>().last, get_state<State_>().last_recursive), ...);
+    published_.end_write(get_state<TopState_>().last_recursive, epoch_);
+  }
+
+  sc_t& select_branch() {
+    if constexpr(resolves_conflicts) {
+      return conflicts_.candidate;
+    }
+    else {
+      return target_branch_;
+    }
+  }
+
+  // Merges the requests of State_'s reaction into the step according to the
+  // conflict policy.
+  template <typename State_>
+  void resolve() {
+    using Policy = conflict_policy_t<TopState_>;
+    using Resolution = ConflictResolution<TopState_>;
+    constexpr int rank = Policy::template rank<State_>;
+    auto& c = conflicts_;
+    const sc_t branch = std::exchange(c.candidate, sc_t{0});
+    if(!branch && !this->action_) {
+      return;
+    }
+    sc_t conflicting = 0;
+    bool beaten = false;
+    for(std::size_t i = 0; i < c.count; i++) {
+      if(!is_valid<TopState_>(c.requests[i].branch, branch)) {
+        conflicting |= sc_t{1} << i;
+        beaten = beaten || Policy::reject_all || c.requests[i].rank >= rank;
+      }
+    }
+    if(conflicting) {
+      c.report.conflicts++;
+      c.report.sources |= state_combination_v<State_>;
+      std::size_t kept = 0;
+      for(std::size_t i = 0; i < c.count; i++) {
+        const bool conflicts = (conflicting >> i) & 1;
+        if(conflicts) {
+          c.report.sources |= c.requests[i].source;
+        }
+        if(conflicts && (!beaten || Policy::reject_all)) {
+          c.report.rejected |= c.requests[i].source;
+          if(c.action_owner == i) {
+            c.action.reset();
+            c.action_owner = Resolution::capacity;
+          }
+          continue;
+        }
+        if(c.action_owner == i) {
+          c.action_owner = kept;
+        }
+        c.requests[kept++] = c.requests[i];
+      }
+      c.count = kept;
+      target_branch_ = 0;
+      for(std::size_t i = 0; i < c.count; i++) {
+        target_branch_ |= c.requests[i].branch;
+      }
+      if(beaten) {
+        c.report.rejected |= state_combination_v<State_>;
+        this->action_.reset();
+        target_ = 0;
+        return;
+      }
+    }
+    c.requests[c.count] = {branch, state_combination_v<State_>, rank};
+    if(this->action_) {
+      c.action = std::move(this->action_);
+      this->action_.reset();
+      c.action_owner = c.count;
+    }
+    c.count++;
+    target_branch_ |= branch;
+  }
+
+  // Without a target, only the actions run: the walks along the active states
+  // would neither exit nor enter any.
+  bool execute_transition() {
+    if(target_branch_) {
+      active_state_configuration_->exit(target_branch_);
+    }
+    if constexpr(resolves_conflicts) {
+      if(conflicts_.action) {
+        this->action_ = std::move(conflicts_.action);
+        conflicts_.action.reset();
+      }
+    }
+    execute_actions();
+    if(this->pending_) {
+      return false;
+    }
+    return enter_target();
+  }
+
+  bool enter_target() {
+    bool entered = target_branch_;
+    if(entered) {
+      active_state_configuration_->enter(target_branch_);
+    }
+    target_ = 0;
+    target_branch_ = 0;
+    if constexpr(resolves_conflicts) {
+      conflicts_.count = 0;
+      conflicts_.action_owner = ConflictResolution<TopState_>::capacity;
+    }
+    return entered;
+  }
+
+  template <typename Event_>
+  bool defer([[maybe_unused]] const Event_& event) {
+    if constexpr(max_deferred_events_v<TopState_> == 0) {
+      return false;
+    }
+#if METAHSM_HOSTED
+    else {
+      auto deliver = [this, event] { dispatch<Event_>(event); };
+      static_assert(InplaceFunction<void()>::fits<decltype(deliver)>, "event too large to defer in place, raise METAHSM_ACTION_CAPACITY");
+      return deferred_.push(std::move(deliver));
+    }
+#endif
+  }
+
+  void run_to_completion(bool entered) {
+    if constexpr(wrapper_t<TopState_>::template HAS_REACT_RECURSIVE<Completion>) {
+      for(std::size_t step = 0; entered && step < max_completion_steps_v<TopState_>; step++) {
+        trace_event<Completion>();
+        active_state_configuration_->handle_event(Completion{});
+        entered = execute_transition();
+      }
+      // still transitioning after the last step
+      stable_ = !entered;
+    }
+  }
+
+#if METAHSM_HOSTED
+  template <typename ... Event_>
+  WireStatus dispatch_wire(std::size_t handler, const std::byte* frame, std::size_t size, type_identity<std::tuple<Event_...>>) {
+    using Handler = WireStatus (StateMachine::*)(const std::byte*, std::size_t);
+    static constexpr Handler handlers[] = {&StateMachine::template dispatch_frame<Event_>...};
+    return (this->*handlers[handler])(frame, size);
+  }
+
+  template <typename Event_>
+  WireStatus dispatch_frame(const std::byte* frame, std::size_t size) {
+    if (size != wire_frame_size_v<Event_>) {
+      return WireStatus::rejected;
+    }
+    const bool reacted = wire_payload_aligned<Event_>(frame)
+        ? dispatch<Event_>(wire_event_view<Event_>(frame))
+        : dispatch<Event_>(read_wire_event<Event_>(frame));
+    return reacted ? WireStatus::reacted : WireStatus::ignored;
+  }
+#endif
+
   void execute_actions() {
     if(this->action_) {
-      std::invoke(*this->action_);
+      this->action_();
       this->action_.reset();
     }
   }
@@ -0,0 +1,249 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "type_traits.hpp"
+#include "trace.hpp"
+#include "resident_slot.hpp"
+
+// Machine state resident in caller-provided memory, such as an mmap()ed shared
+// file, for inspection by other processes. A top state declaring
+//
+//   static constexpr bool resident_configuration = true;
+//   using ResidentData = Counters;                 // optional, trivially copyable
+//   Counters resident_data() const;                // required with ResidentData
+//
+// can be attached to a slot of a ResidentRegion; the machine then mirrors its
+// epoch, configuration and the last/last_recursive words of every state into
+// the slot after each change, and its ResidentData after each reaction. A
+// reader maps the region read-only and decodes it with ResidentReader, from
+// the layout described in the region itself:
+//
+//   ResidentHeader, then the state names table at names_offset: state_count
+//   entries {u32 offset from names_offset, u32 length}, then the characters;
+//   then machine_count slots of slot_size bytes from slots_offset, each a
+//   sequence of 64-bit words: seqlock sequence (odd while written), epoch,
+//   active states, last[state_count], last_recursive[state_count], and
+//   data_size bytes of ResidentData.
+//
+// Words are in native byte order and read with atomic loads, so the writer and
+// the readers run on the same host. The state machine keeps working on its own
+// storage; the slot is a mirror written with relaxed stores under the seqlock.
+
+namespace metahsm {
+
+constexpr char resident_magic[8] = "metahsm";
+constexpr std::uint32_t resident_version = 1;
+constexpr std::size_t resident_alignment = 64;
+
+struct ResidentHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_size;
+  std::uint32_t state_count;
+  std::uint32_t data_size;
+  std::uint64_t machine_count;
+  std::uint64_t slot_size;
+  std::uint64_t names_offset;
+  std::uint64_t slots_offset;
+};
+
+constexpr std::size_t resident_round_up(std::size_t size) {
+  return (size + resident_alignment - 1) / resident_alignment * resident_alignment;
+}
+
+constexpr std::size_t resident_data_words(std::size_t data_size) {
+  return (data_size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+}
+
+constexpr std::size_t resident_slot_words(std::size_t states, std::size_t data_size) {
+  return resident_last + 2 * states + resident_data_words(data_size);
+}
+
+constexpr std::size_t resident_slot_size(std::size_t states, std::size_t data_size) {
+  return resident_round_up(resident_slot_words(states, data_size) * sizeof(std::uint64_t));
+}
+
+template <typename TopState_>
+constexpr std::size_t resident_data_size_v = std::is_void_v<resident_data_t<TopState_>> ? 0 : sizeof(resident_data_t<TopState_>);
+
+// Region of machine_count slots for machines of TopState_, formatted in
+// caller-provided memory of size(machine_count) bytes, aligned to 64 bytes.
+template <typename TopState_>
+class ResidentRegion
+{
+public:
+  static_assert(resident_configuration_v<TopState_>, "the top state does not declare resident_configuration");
+  static_assert(std::is_void_v<resident_data_t<TopState_>> || std::is_trivially_copyable_v<resident_data_t<TopState_>>,
+      "ResidentData must be trivially copyable");
+
+  static constexpr std::size_t states = std::tuple_size_v<all_states_t<TopState_>>;
+  static constexpr std::size_t data_size = resident_data_size_v<TopState_>;
+  static constexpr std::size_t names_size = [] {
+    std::size_t size = states * 2 * sizeof(std::uint32_t);
+    for (auto name : state_names<TopState_>) {
+      size += name.size();
+    }
+    return size;
+  }();
+  static constexpr std::size_t names_offset = sizeof(ResidentHeader);
+  static constexpr std::size_t slots_offset = resident_round_up(names_offset + names_size);
+  static constexpr std::size_t slot_size = resident_slot_size(states, data_size);
+
+  static constexpr std::size_t size(std::size_t machine_count) {
+    return slots_offset + machine_count * slot_size;
+  }
+
+  // Writes the header and the names and clears the slots. Format before
+  // attaching machines; readers reject the region until the magic is written.
+  ResidentRegion(void* memory, std::size_t machine_count)
+    : memory_(static_cast<std::byte*>(memory)), machine_count_(machine_count) {
+    std::memset(memory_, 0, size(machine_count));
+    std::uint32_t offset = states * 2 * sizeof(std::uint32_t);
+    for (std::size_t id = 0; id < states; id++) {
+      const std::uint32_t entry[2] = {offset, static_cast<std::uint32_t>(state_names<TopState_>[id].size())};
+      std::memcpy(memory_ + names_offset + id * sizeof(entry), entry, sizeof(entry));
+      std::memcpy(memory_ + names_offset + offset, state_names<TopState_>[id].data(), entry[1]);
+      offset += entry[1];
+    }
+    ResidentHeader header{{}, resident_version, sizeof(ResidentHeader), states, data_size,
+        machine_count, slot_size, names_offset, slots_offset};
+    std::memcpy(memory_, &header, sizeof(header));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(memory_, resident_magic, sizeof(resident_magic));
+  }
+
+  std::size_t machine_count() const { return machine_count_; }
+
+  // For StateMachine::attach().
+  ResidentSlot slot(std::size_t machine) const {
+    return ResidentSlot{memory_ + slots_offset + machine * slot_size, states};
+  }
+
+private:
+  std::byte* memory_;
+  std::size_t machine_count_;
+};
+
+enum class ResidentStatus : std::uint8_t
+{
+  ok,
+  unwritten,   // the machine has not written its slot yet
+  torn,        // the slot stayed mid-write, e.g. its writer died during a change
+  out_of_range // no such machine, or an invalid reader
+};
+
+// Copy of one slot, all from the same change.
+struct ResidentSnapshot
+{
+  std::uint64_t epoch = 0;
+  std::uint64_t active = 0;
+  std::vector<std::uint64_t> last;
+  std::vector<std::uint64_t> last_recursive;
+  std::vector<std::byte> data;
+};
+
+// Decodes a region from its header alone, e.g. in a process that maps the
+// file read-only and does not know the machine type.
+class ResidentReader
+{
+public:
+  // Invalid unless memory holds a region of this version within size bytes.
+  ResidentReader(const void* memory, std::size_t size) : memory_(static_cast<const std::byte*>(memory)) {
+    if (size < sizeof(ResidentHeader) || std::memcmp(memory_, resident_magic, sizeof(resident_magic)) != 0) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::memcpy(&header_, memory_, sizeof(header_));
+    const bool valid = header_.version == resident_version && header_.header_size >= sizeof(ResidentHeader)
+        && header_.state_count > 0 && header_.state_count <= 64
+        && header_.names_offset + header_.state_count * 2 * sizeof(std::uint32_t) <= size
+        && header_.slot_size >= resident_slot_words(header_.state_count, header_.data_size) * sizeof(std::uint64_t)
+        && header_.slots_offset % sizeof(std::uint64_t) == 0 && header_.slot_size % sizeof(std::uint64_t) == 0
+        && header_.slots_offset <= size && header_.machine_count <= (size - header_.slots_offset) / header_.slot_size;
+    if (!valid) {
+      return;
+    }
+    names_.resize(header_.state_count);
+    for (std::size_t id = 0; id < header_.state_count; id++) {
+      std::uint32_t entry[2];
+      std::memcpy(entry, memory_ + header_.names_offset + id * sizeof(entry), sizeof(entry));
+      if (header_.names_offset + entry[0] + entry[1] > size) {
+        return;
+      }
+      names_[id] = std::string_view(reinterpret_cast<const char*>(memory_ + header_.names_offset + entry[0]), entry[1]);
+    }
+    valid_ = true;
+  }
+
+  explicit operator bool() const { return valid_; }
+
+  std::size_t machine_count() const { return header_.machine_count; }
+  std::size_t state_count() const { return header_.state_count; }
+  std::size_t data_size() const { return header_.data_size; }
+  std::string_view state_name(std::size_t id) const { return names_[id]; }
+
+  // Retries while the machine is writing its slot, up to attempts times; the
+  // snapshot is only complete with ResidentStatus::ok.
+  ResidentStatus read(std::size_t machine, ResidentSnapshot& snapshot, std::size_t attempts = 1 << 16) const {
+    if (!valid_ || machine >= header_.machine_count) {
+      return ResidentStatus::out_of_range;
+    }
+    const std::size_t states = header_.state_count;
+    auto const* words = reinterpret_cast<const std::atomic<std::uint64_t>*>(memory_ + header_.slots_offset + machine * header_.slot_size);
+    snapshot.last.resize(states);
+    snapshot.last_recursive.resize(states);
+    std::vector<std::uint64_t> data(resident_data_words(header_.data_size));
+    std::uint64_t begin, end;
+    do {
+      if (attempts-- == 0) {
+        return ResidentStatus::torn;
+      }
+      begin = words[resident_sequence].load(std::memory_order_acquire);
+      snapshot.epoch = words[resident_epoch].load(std::memory_order_relaxed);
+      snapshot.active = words[resident_active].load(std::memory_order_relaxed);
+      for (std::size_t id = 0; id < states; id++) {
+        snapshot.last[id] = words[resident_last + id].load(std::memory_order_relaxed);
+        snapshot.last_recursive[id] = words[resident_last + states + id].load(std::memory_order_relaxed);
+      }
+      for (std::size_t i = 0; i < data.size(); i++) {
+        data[i] = words[resident_last + 2 * states + i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      end = words[resident_sequence].load(std::memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    snapshot.data.resize(header_.data_size);
+    std::memcpy(snapshot.data.data(), data.data(), header_.data_size);
+    return begin ? ResidentStatus::ok : ResidentStatus::unwritten;
+  }
+
+private:
+  const std::byte* memory_;
+  ResidentHeader header_{};
+  std::vector<std::string_view> names_;
+  bool valid_ = false;
+};
+
+}
@@ -0,0 +1,81 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Layout of a resident slot and its writer, the part of resident.hpp a
+// StateMachine needs to mirror itself; see resident.hpp for the region and
+// its readers.
+
+namespace metahsm {
+
+enum ResidentWord : std::size_t
+{
+  resident_sequence,
+  resident_epoch,
+  resident_active,
+  resident_last
+};
+
+// Writer of one slot, held by the attached StateMachine.
+class ResidentSlot
+{
+public:
+  ResidentSlot() = default;
+  ResidentSlot(void* slot, std::size_t states) : words_(static_cast<std::atomic<std::uint64_t>*>(slot)), states_(states) {}
+
+  explicit operator bool() const { return words_ != nullptr; }
+
+  void begin_write() {
+    store(resident_sequence, words_[resident_sequence].load(std::memory_order_relaxed) + 1);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void write(std::size_t id, std::uint64_t last, std::uint64_t last_recursive) {
+    store(resident_last + id, last);
+    store(resident_last + states_ + id, last_recursive);
+  }
+
+  void write_data(const void* data, std::size_t size) {
+    std::uint64_t word;
+    for (std::size_t offset = 0, i = resident_last + 2 * states_; offset < size; offset += sizeof(word), i++) {
+      word = 0;
+      std::memcpy(&word, static_cast<const std::byte*>(data) + offset, size - offset < sizeof(word) ? size - offset : sizeof(word));
+      store(i, word);
+    }
+  }
+
+  void end_write(std::uint64_t active, std::uint64_t epoch) {
+    store(resident_active, active);
+    store(resident_epoch, epoch);
+    words_[resident_sequence].store(words_[resident_sequence].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+private:
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "slots are shared between processes");
+
+  void store(std::size_t word, std::uint64_t value) {
+    words_[word].store(value, std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t>* words_ = nullptr;
+  std::size_t states_ = 0;
+};
+
+}
@@ -0,0 +1,546 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "wire.hpp"
+#include "spsc.hpp"
+
+// Machines sharded across processes (POSIX; shared rings need Linux or another
+// system with lock-free 64-bit atomics in shared mappings). A ShardRouter in
+// the sending process batches wire frames per shard and writes them to one
+// link per worker process; a ShardWorker reads them and dispatches each frame
+// through StateMachine::dispatch_bytes(). A link is any byte stream with
+//
+//   bool write(const std::byte* data, std::size_t size); // false if broken
+//   bool read(std::byte* data, std::size_t size);        // false at the end
+//   void close();                                        // ends the stream
+//
+// such as UnixSocket and SharedRing below. A batch is a 16-byte header (u32
+// bytes after the header, u32 frame count, u64 steady clock at the write),
+// followed by its records: an 8-byte record header (u32 machine id, u16 frame
+// size, u16 zero) and the wire frame, zero padded to a multiple of 8 bytes so
+// that every frame starts 8-byte aligned. Fields are in native byte order:
+// both sides run on the same host.
+
+namespace metahsm {
+
+constexpr std::size_t shard_batch_header_size = 16;
+constexpr std::size_t shard_record_header_size = 8;
+constexpr std::size_t shard_record_alignment = 8;
+
+// Bytes a frame of frame_size takes in a batch, padding included.
+constexpr std::size_t shard_padded_frame_size(std::size_t frame_size) {
+  return (frame_size + shard_record_alignment - 1) / shard_record_alignment * shard_record_alignment;
+}
+
+// Machine ids are spread round-robin: shard_of() is the worker holding a
+// machine and shard_index() its index among the machines of that worker.
+constexpr std::size_t shard_of(std::uint32_t instance, std::size_t shards) {
+  return instance % shards;
+}
+
+constexpr std::size_t shard_index(std::uint32_t instance, std::size_t shards) {
+  return instance / shards;
+}
+
+// Nanoseconds of the steady clock, which is CLOCK_MONOTONIC on Linux and thus
+// comparable between processes.
+inline std::uint64_t shard_clock_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters of one shard, on either side of its link.
+struct ShardMetrics
+{
+  std::uint64_t events = 0;           // frames written, or dispatched with a reaction
+  std::uint64_t ignored = 0;          // frames dispatched without a reaction
+  std::uint64_t rejected = 0;         // frames of failed writes, or without machine, or malformed or unknown
+  std::uint64_t batches = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t latency_total_ns = 0; // per batch: the write, or from the write to the last dispatch
+  std::uint64_t latency_max_ns = 0;
+  std::uint64_t first_ns = 0;         // clock at the end of the first and the last batch
+  std::uint64_t last_ns = 0;
+
+  void record(std::uint64_t frames, std::uint64_t unhandled, std::uint64_t lost, std::uint64_t size, std::uint64_t begin_ns, std::uint64_t end_ns) {
+    events += frames;
+    ignored += unhandled;
+    rejected += lost;
+    batches++;
+    bytes += size;
+    const std::uint64_t latency = end_ns > begin_ns ? end_ns - begin_ns : 0;
+    latency_total_ns += latency;
+    latency_max_ns = std::max(latency_max_ns, latency);
+    first_ns = first_ns ? first_ns : end_ns;
+    last_ns = end_ns;
+  }
+
+  double events_per_second() const {
+    return last_ns > first_ns ? events * 1e9 / (last_ns - first_ns) : 0;
+  }
+
+  double mean_latency_ns() const {
+    return batches ? static_cast<double>(latency_total_ns) / batches : 0;
+  }
+};
+
+// Link over a connected stream socket, typically one end of pair() with the
+// other end kept by a forked worker.
+class UnixSocket
+{
+public:
+  UnixSocket() = default;
+  explicit UnixSocket(int fd) : fd_(fd) {}
+  UnixSocket(UnixSocket&& other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+  UnixSocket& operator=(UnixSocket&& other) noexcept {
+    if (this != &other) {
+      release();
+      fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+  }
+  ~UnixSocket() { release(); }
+
+  // Both ends are invalid if the pair could not be created.
+  static std::array<UnixSocket, 2> pair() {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+      return {};
+    }
+    return {UnixSocket{fds[0]}, UnixSocket{fds[1]}};
+  }
+
+  explicit operator bool() const { return fd_ >= 0; }
+  int fd() const { return fd_; }
+
+  bool write(const std::byte* data, std::size_t size) {
+    while (size > 0) {
+      const ssize_t n = ::send(fd_, data, size, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool read(std::byte* data, std::size_t size) {
+    while (size > 0) {
+      const ssize_t n = ::recv(fd_, data, size, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  // Shuts down the sending direction, so the peer reads to the end even while
+  // a forked process still holds a copy of this descriptor.
+  void close() {
+    if (fd_ >= 0) {
+      ::shutdown(fd_, SHUT_WR);
+    }
+  }
+
+private:
+  void release() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  int fd_ = -1;
+};
+
+// Link over a single-producer/single-consumer byte ring in a shared mapping:
+// no system call per batch, the reader polls. Create it before fork(), or map
+// the same file (memfd_create(), shm_open()) of region_size() bytes in both
+// processes; a zero-filled region is an empty ring. Each side records its
+// process id on its first call, and a side waiting on the ring gives up once
+// the other process has exited, or once timeout passed without progress if
+// given. The writer and the reader must each stay in one process.
+class SharedRing
+{
+public:
+  static constexpr std::size_t region_size(std::size_t capacity) {
+    return sizeof(Header) + capacity;
+  }
+
+  // Anonymous mapping, inherited by forked processes.
+  explicit SharedRing(std::size_t capacity, std::chrono::nanoseconds timeout = {})
+    : SharedRing(-1, capacity, timeout) {}
+
+  SharedRing(int fd, std::size_t capacity, std::chrono::nanoseconds timeout = {})
+    : capacity_(capacity), timeout_ns_(timeout.count()) {
+    void* region = ::mmap(nullptr, region_size(capacity), PROT_READ | PROT_WRITE,
+        fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+    if (region != MAP_FAILED) {
+      header_ = static_cast<Header*>(region);
+    }
+  }
+
+  SharedRing(SharedRing&& other) noexcept
+    : header_(std::exchange(other.header_, nullptr)), capacity_(other.capacity_), timeout_ns_(other.timeout_ns_),
+      writing_(other.writing_), reading_(other.reading_) {}
+  SharedRing& operator=(SharedRing&& other) noexcept {
+    if (this != &other) {
+      release();
+      header_ = std::exchange(other.header_, nullptr);
+      capacity_ = other.capacity_;
+      timeout_ns_ = other.timeout_ns_;
+      writing_ = other.writing_;
+      reading_ = other.reading_;
+    }
+    return *this;
+  }
+  ~SharedRing() { release(); }
+
+  explicit operator bool() const { return header_ != nullptr; }
+
+  // Waits for room while the ring is full; fails once either side closed it,
+  // or once the reader is gone.
+  bool write(const std::byte* data, std::size_t size) {
+    attach(writing_, header_->writer);
+    Wait wait;
+    while (size > 0) {
+      if (header_->closed.load(std::memory_order_acquire)) {
+        return false;
+      }
+      const std::uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+      const std::size_t room = capacity_ - (tail - header_->head.load(std::memory_order_acquire));
+      if (room == 0) {
+        if (!wait(header_->reader, timeout_ns_)) {
+          return false;
+        }
+        continue;
+      }
+      const std::size_t n = std::min(size, room);
+      copy_in(tail, data, n);
+      header_->tail.store(tail + n, std::memory_order_release);
+      data += n;
+      size -= n;
+      wait = {};
+    }
+    return true;
+  }
+
+  // Waits for data while the ring is empty; fails once it is empty and
+  // closed, or once it is empty and the writer is gone.
+  bool read(std::byte* data, std::size_t size) {
+    attach(reading_, header_->reader);
+    Wait wait;
+    while (size > 0) {
+      const std::uint64_t head = header_->head.load(std::memory_order_relaxed);
+      const std::size_t available = header_->tail.load(std::memory_order_acquire) - head;
+      if (available == 0) {
+        if (header_->closed.load(std::memory_order_acquire) && header_->tail.load(std::memory_order_acquire) == head) {
+          return false;
+        }
+        if (!wait(header_->writer, timeout_ns_)) {
+          return false;
+        }
+        continue;
+      }
+      const std::size_t n = std::min(size, available);
+      copy_out(head, data, n);
+      header_->head.store(head + n, std::memory_order_release);
+      data += n;
+      size -= n;
+      wait = {};
+    }
+    return true;
+  }
+
+  void close() {
+    header_->closed.store(1, std::memory_order_release);
+  }
+
+private:
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free,
+      "ring counters are shared between processes");
+
+  struct Header
+  {
+    alignas(cache_line_size) std::atomic<std::uint64_t> head;
+    alignas(cache_line_size) std::atomic<std::uint64_t> tail;
+    alignas(cache_line_size) std::atomic<std::uint32_t> closed;
+    std::atomic<std::int32_t> writer; // process ids, 0 until the first call
+    std::atomic<std::int32_t> reader;
+  };
+
+  // Polling of a side waiting on its peer. The peer's process is looked up at
+  // most every peer_check_ns, so the wait stays free of system calls while the
+  // peer keeps up.
+  struct Wait
+  {
+    static constexpr std::uint64_t peer_check_ns = 1000000;
+    std::uint64_t since_ns = 0;
+    std::uint64_t checked_ns = 0;
+
+    bool operator()(std::atomic<std::int32_t> const& peer, std::uint64_t timeout_ns) {
+      const std::uint64_t now = shard_clock_ns();
+      if (!since_ns) {
+        since_ns = checked_ns = now;
+      }
+      if (now - checked_ns >= peer_check_ns) {
+        checked_ns = now;
+        const std::int32_t pid = peer.load(std::memory_order_acquire);
+        if (pid && !alive(pid)) {
+          return false;
+        }
+      }
+      if (timeout_ns && now - since_ns >= timeout_ns) {
+        return false;
+      }
+      std::this_thread::yield();
+      return true;
+    }
+
+    // An exited child stays a zombie until reaped, and kill() still finds it:
+    // ask waitid() first, without reaping it.
+    static bool alive(pid_t pid) {
+      siginfo_t info{};
+      if (::waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0) {
+        return info.si_pid == 0;
+      }
+      return ::kill(pid, 0) == 0 || errno != ESRCH;
+    }
+  };
+
+  // Records the calling process as one side of the ring, once per process.
+  void attach(bool& attached, std::atomic<std::int32_t>& side) {
+    if (!attached) {
+      attached = true;
+      side.store(::getpid(), std::memory_order_release);
+    }
+  }
+
+  std::byte* ring() const {
+    return reinterpret_cast<std::byte*>(header_ + 1);
+  }
+
+  void copy_in(std::uint64_t position, const std::byte* data, std::size_t n) {
+    const std::size_t offset = position % capacity_;
+    const std::size_t first = std::min(n, capacity_ - offset);
+    std::memcpy(ring() + offset, data, first);
+    std::memcpy(ring(), data + first, n - first);
+  }
+
+  void copy_out(std::uint64_t position, std::byte* data, std::size_t n) const {
+    const std::size_t offset = position % capacity_;
+    const std::size_t first = std::min(n, capacity_ - offset);
+    std::memcpy(data, ring() + offset, first);
+    std::memcpy(data + first, ring(), n - first);
+  }
+
+  void release() {
+    if (header_) {
+      ::munmap(header_, region_size(capacity_));
+      header_ = nullptr;
+    }
+  }
+
+  Header* header_ = nullptr;
+  std::size_t capacity_ = 0;
+  std::uint64_t timeout_ns_ = 0;
+  bool writing_ = false;
+  bool reading_ = false;
+};
+
+// Sending side: one link per shard. Frames are appended to the batch of their
+// shard, which is written when the next frame would not fit in batch_bytes,
+// or on flush().
+template <typename Link_>
+class ShardRouter
+{
+public:
+  explicit ShardRouter(std::vector<Link_> links, std::size_t batch_bytes = 16384)
+    : links_(std::move(links)), batches_(links_.size()), counts_(links_.size()), metrics_(links_.size()),
+      batch_bytes_(batch_bytes) {
+    for (auto& batch : batches_) {
+      batch.reserve(batch_bytes_);
+      batch.resize(shard_batch_header_size);
+    }
+  }
+
+  std::size_t shards() const { return links_.size(); }
+
+  // Queues event for machine `instance`. Returns false if the batch it
+  // displaced could not be written.
+  template <typename Event_>
+  bool send(std::uint32_t instance, Event_ const& event) {
+    static_assert(is_wire_event_v<Event_>, "sharded events need a wire_id and a trivially copyable layout");
+    static_assert(wire_frame_size_v<Event_> <= UINT16_MAX, "wire frame too large for a shard record");
+    const std::size_t shard = shard_of(instance, links_.size());
+    std::vector<std::byte>& batch = batches_[shard];
+    const std::size_t record_size = shard_record_header_size + shard_padded_frame_size(wire_frame_size_v<Event_>);
+    const bool written = batch.size() + record_size <= batch_bytes_ || flush(shard);
+    const std::size_t offset = batch.size();
+    const std::uint16_t frame_size = wire_frame_size_v<Event_>;
+    batch.resize(offset + record_size);
+    std::memcpy(&batch[offset], &instance, sizeof(instance));
+    std::memcpy(&batch[offset + sizeof(instance)], &frame_size, sizeof(frame_size));
+    std::memset(&batch[offset + sizeof(instance) + sizeof(frame_size)], 0, 2);
+    const std::size_t frame = offset + shard_record_header_size;
+    write_wire_frame(event, &batch[frame]);
+    std::memset(&batch[frame + frame_size], 0, record_size - shard_record_header_size - frame_size);
+    counts_[shard]++;
+    return written;
+  }
+
+  // Writes the pending batch of shard; the frames of a failed write are lost.
+  bool flush(std::size_t shard) {
+    std::vector<std::byte>& batch = batches_[shard];
+    const std::uint32_t count = counts_[shard];
+    if (count == 0) {
+      return true;
+    }
+    const std::uint32_t size = static_cast<std::uint32_t>(batch.size() - shard_batch_header_size);
+    const std::uint64_t begin = shard_clock_ns();
+    std::memcpy(&batch[0], &size, sizeof(size));
+    std::memcpy(&batch[4], &count, sizeof(count));
+    std::memcpy(&batch[8], &begin, sizeof(begin));
+    const bool written = links_[shard].write(batch.data(), batch.size());
+    metrics_[shard].record(written ? count : 0, 0, written ? 0 : count, batch.size(), begin, shard_clock_ns());
+    batch.resize(shard_batch_header_size);
+    counts_[shard] = 0;
+    return written;
+  }
+
+  bool flush() {
+    bool written = true;
+    for (std::size_t shard = 0; shard < links_.size(); shard++) {
+      written = flush(shard) && written;
+    }
+    return written;
+  }
+
+  // Flushes and ends the stream of every shard; workers return from run().
+  bool close() {
+    const bool written = flush();
+    for (auto& link : links_) {
+      link.close();
+    }
+    return written;
+  }
+
+  ShardMetrics const& metrics(std::size_t shard) const { return metrics_[shard]; }
+  Link_& link(std::size_t shard) { return links_[shard]; }
+
+private:
+  std::vector<Link_> links_;
+  std::vector<std::vector<std::byte>> batches_;
+  std::vector<std::uint32_t> counts_;
+  std::vector<ShardMetrics> metrics_;
+  std::size_t batch_bytes_;
+};
+
+// Receiving side, in the worker process of one shard.
+template <typename Link_>
+class ShardWorker
+{
+public:
+  // Batches above max_batch_bytes are taken as malformed: the router's
+  // batch_bytes plus its largest record must fit.
+  explicit ShardWorker(Link_ link, std::size_t max_batch_bytes = 1 << 20)
+    : link_(std::move(link)), max_batch_bytes_(max_batch_bytes) {}
+
+  // Reads one batch and hands each frame to the dispatch_bytes() of the
+  // machine resolve(instance) points to; a null machine rejects the frame.
+  // Returns false at the end of the stream or on a malformed batch.
+  template <typename Resolve_>
+  bool receive(Resolve_ && resolve) {
+    std::byte header[shard_batch_header_size];
+    if (!link_.read(header, shard_batch_header_size)) {
+      return false;
+    }
+    std::uint32_t size, count;
+    std::uint64_t sent;
+    std::memcpy(&size, &header[0], sizeof(size));
+    std::memcpy(&count, &header[4], sizeof(count));
+    std::memcpy(&sent, &header[8], sizeof(sent));
+    if (size > max_batch_bytes_ || count > size / shard_record_header_size) {
+      return false;
+    }
+    buffer_.resize(size);
+    if (!link_.read(buffer_.data(), size)) {
+      return false;
+    }
+    std::uint64_t reacted = 0, ignored = 0, frames = 0;
+    for (std::size_t offset = 0; frames < count && offset + shard_record_header_size <= size; frames++) {
+      std::uint32_t instance;
+      std::uint16_t frame_size;
+      std::memcpy(&instance, &buffer_[offset], sizeof(instance));
+      std::memcpy(&frame_size, &buffer_[offset + sizeof(instance)], sizeof(frame_size));
+      offset += shard_record_header_size;
+      if (shard_padded_frame_size(frame_size) > size - offset) {
+        break;
+      }
+      if (auto* machine = resolve(instance)) {
+        const WireStatus status = machine->dispatch_bytes(&buffer_[offset], frame_size);
+        reacted += status == WireStatus::reacted;
+        ignored += status == WireStatus::ignored;
+      }
+      offset += shard_padded_frame_size(frame_size);
+    }
+    metrics_.record(reacted, ignored, count - reacted - ignored, shard_batch_header_size + size, sent, shard_clock_ns());
+    return frames == count;
+  }
+
+  // Dispatches batches until the router closes the link.
+  template <typename Resolve_>
+  void run(Resolve_ && resolve) {
+    while (receive(resolve)) {}
+  }
+
+  ShardMetrics const& metrics() const { return metrics_; }
+  Link_& link() { return link_; }
+
+private:
+  Link_ link_;
+  std::size_t max_batch_bytes_;
+  std::vector<std::byte> buffer_;
+  ShardMetrics metrics_;
+};
+
+}
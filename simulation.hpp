@@ -0,0 +1,450 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "metahsm.hpp"
+#include "bus.hpp"
+
+namespace metahsm {
+
+// Virtual time, in ticks of the user's choice.
+using SimulationTime = std::uint64_t;
+
+// Calendar queue (R. Brown, 1988): a year of time buckets, each a binary heap
+// with its earliest entry on top. Pushing and popping are O(1) on average; the
+// number of buckets and their width follow the population of the queue, and
+// many entries at the same time cost O(log n) rather than a linear insert.
+// Entry_ has `time` and `sequence`; entries are popped in that order.
+template <typename Entry_>
+class CalendarQueue
+{
+public:
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+
+  void push(Entry_ const& entry) {
+    if (buckets_.empty()) {
+      rebuild(min_buckets, 1, entry.time);
+    }
+    if (entry.time < bucket_top_ - width_) {
+      position(entry.time);
+    }
+    insert(entry);
+    if (++size_ > 2 * buckets_.size()) {
+      resize(2 * buckets_.size());
+    }
+  }
+
+  // Time of the earliest entry. The queue must not be empty.
+  SimulationTime next_time() {
+    locate();
+    return buckets_[current_].front().time;
+  }
+
+  Entry_ pop() {
+    locate();
+    auto& b = buckets_[current_];
+    std::pop_heap(b.begin(), b.end(), later);
+    Entry_ entry = std::move(b.back());
+    b.pop_back();
+    if (--size_ < buckets_.size() / 2 && buckets_.size() > min_buckets) {
+      resize(buckets_.size() / 2);
+    }
+    return entry;
+  }
+
+private:
+  static constexpr std::size_t min_buckets = 16;
+
+  static bool later(Entry_ const& a, Entry_ const& b) {
+    return a.time > b.time || (a.time == b.time && a.sequence > b.sequence);
+  }
+
+  std::size_t bucket(SimulationTime time) const {
+    return (time / width_) % buckets_.size();
+  }
+
+  void insert(Entry_ const& entry) {
+    auto& b = buckets_[bucket(entry.time)];
+    b.push_back(entry);
+    std::push_heap(b.begin(), b.end(), later);
+  }
+
+  // Makes the bucket of time the current one.
+  void position(SimulationTime time) {
+    current_ = bucket(time);
+    bucket_top_ = (time / width_ + 1) * width_;
+  }
+
+  // Moves the current bucket to the one holding the earliest entry.
+  void locate() {
+    const std::size_t n = buckets_.size();
+    for (std::size_t k = 0; k < n; k++) {
+      auto const& b = buckets_[current_];
+      if (!b.empty() && b.front().time < bucket_top_) {
+        return;
+      }
+      current_ = current_ + 1 == n ? 0 : current_ + 1;
+      bucket_top_ += width_;
+    }
+    // nothing within a year: jump to the earliest entry
+    const Entry_* earliest = nullptr;
+    for (auto const& b : buckets_) {
+      if (!b.empty() && (!earliest || later(*earliest, b.front()))) {
+        earliest = &b.front();
+      }
+    }
+    position(earliest->time);
+  }
+
+  // Rebuilds with the width set to about three times the average gap between
+  // the earliest entries.
+  void resize(std::size_t count) {
+    std::vector<Entry_> entries;
+    entries.reserve(size_);
+    for (auto& b : buckets_) {
+      std::move(b.begin(), b.end(), std::back_inserter(entries));
+    }
+    const std::size_t sample = std::min<std::size_t>(entries.size(), 32);
+    std::partial_sort(entries.begin(), entries.begin() + sample, entries.end(),
+        [](Entry_ const& a, Entry_ const& b) { return later(b, a); });
+    SimulationTime width = 1;
+    if (sample > 1) {
+      width = std::max<SimulationTime>(1, 3 * (entries[sample - 1].time - entries[0].time) / (sample - 1));
+    }
+    rebuild(count, width, entries.empty() ? bucket_top_ - width_ : entries[0].time);
+    for (auto const& entry : entries) {
+      insert(entry);
+    }
+  }
+
+  void rebuild(std::size_t count, SimulationTime width, SimulationTime start) {
+    buckets_.clear();
+    buckets_.resize(count);
+    width_ = width;
+    position(start);
+  }
+
+  std::vector<std::vector<Entry_>> buckets_;
+  std::size_t size_ = 0;
+  std::size_t current_ = 0;
+  SimulationTime width_ = 1;
+  SimulationTime bucket_top_ = 1;
+};
+
+// Discrete-event simulation of a population of machines with top state
+// TopState_, addressed by instance number like on the Bus. Events of
+// mailbox_t<TopState_> are delivered in timestamp order from a calendar
+// queue; ties keep the order they were scheduled in. During a run, react()
+// code can read now() and self(), set timers with after(), and message other
+// instances with send<TopState_>(), which arrives latency ticks later.
+//
+// Instances are split into partitions (instance % partitions, with at least
+// one partition). run_parallel()
+// runs each partition on its own thread in conservative windows of latency
+// ticks: a message never arrives in the window it was sent in, so partitions
+// only synchronize between windows, and the result is the same as run().
+template <typename TopState_>
+class Simulation
+{
+public:
+  using Event = mailbox_t<TopState_>;
+
+  explicit Simulation(SimulationTime latency = 1, std::size_t partitions = 1)
+  : latency_{latency},
+    partitions_(std::max<std::size_t>(partitions, 1))
+  {
+    for (std::size_t p = 0; p < partitions_.size(); p++) {
+      partitions_[p].simulation = this;
+      partitions_[p].index = p;
+    }
+  }
+
+  Simulation(Simulation const&) = delete;
+  Simulation& operator=(Simulation const&) = delete;
+
+  // Schedules an event from outside the simulation.
+  void schedule(SimulationTime time, std::uint32_t instance, Event const& event) {
+    Partition& target = partition(instance);
+    target.calendar.push({time, target.next_sequence(), instance, event});
+  }
+
+  // Virtual time of the event being dispatched.
+  static SimulationTime now() {
+    return context().now;
+  }
+
+  // Instance the event being dispatched was delivered to.
+  static std::uint32_t self() {
+    return context().self;
+  }
+
+  // Timer: delivers event to the current instance delay ticks from now.
+  static void after(SimulationTime delay, Event const& event) {
+    Context& c = context();
+    c.partition->calendar.push({c.now + delay, c.partition->next_sequence(), c.self, event});
+  }
+
+  // Virtual time reached by the last run.
+  SimulationTime time() const {
+    return time_;
+  }
+
+  std::size_t pending() const {
+    std::size_t count = 0;
+    for (auto const& p : partitions_) {
+      count += p.calendar.size() + p.outbox.size();
+    }
+    return count;
+  }
+
+  // Dispatches every event up to and including time end on this thread to the
+  // machine returned by resolve(instance). Returns the number of events.
+  template <typename Resolve_>
+  std::size_t run(SimulationTime end, Resolve_ && resolve) {
+    std::size_t count = 0;
+    if (partitions_.size() == 1) {
+      count = partitions_[0].run(end + 1, resolve, false);
+    }
+    while (partitions_.size() > 1) {
+      Partition* next = nullptr;
+      SimulationTime next_time = end;
+      for (auto& p : partitions_) {
+        if (!p.calendar.empty() && p.calendar.next_time() <= next_time && (!next || p.calendar.next_time() < next_time)) {
+          next = &p;
+          next_time = p.calendar.next_time();
+        }
+      }
+      if (!next) {
+        break;
+      }
+      count += next->run(next_time + 1, resolve, false);
+    }
+    time_ = std::max(time_, end);
+    return count;
+  }
+
+  // Same as run(), with every partition on its own thread. resolve is called
+  // concurrently for instances of different partitions.
+  template <typename Resolve_>
+  std::size_t run_parallel(SimulationTime end, Resolve_ && resolve) {
+    if (latency_ == 0 || partitions_.size() == 1) {
+      return run(end, resolve);
+    }
+    std::atomic<std::size_t> count{0};
+    next_window(end);
+    Barrier barrier{partitions_.size()};
+    auto work = [&](std::size_t p) {
+      std::size_t local = 0;
+      while (!done_) {
+        local += partitions_[p].run(window_end_, resolve, true);
+        barrier.arrive_and_wait();
+        if (p == 0) {
+          merge_outboxes();
+          next_window(end);
+        }
+        barrier.arrive_and_wait();
+      }
+      count += local;
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t p = 1; p < partitions_.size(); p++) {
+      threads.emplace_back(work, p);
+    }
+    work(0);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    time_ = std::max(time_, end);
+    return count;
+  }
+
+private:
+  struct Entry
+  {
+    SimulationTime time;
+    std::uint64_t sequence;
+    std::uint32_t instance;
+    Event event;
+  };
+
+  struct Partition
+  {
+    Simulation* simulation;
+    std::size_t index;
+    CalendarQueue<Entry> calendar;
+    std::vector<Entry> outbox;
+    std::uint64_t sequence = 0;
+    std::atomic<bool> ready{false};
+
+    // unique across partitions and independent of the thread schedule
+    std::uint64_t next_sequence() {
+      return sequence++ * simulation->partitions_.size() + index;
+    }
+
+    // Dispatches this partition's events before time end.
+    template <typename Resolve_>
+    std::size_t run(SimulationTime end, Resolve_ & resolve, bool parallel) {
+      Context& c = context();
+      const Context saved = c;
+      const auto route = bind();
+      c.simulation = simulation;
+      c.partition = this;
+      c.parallel = parallel;
+      std::size_t count = 0;
+      while (!calendar.empty() && calendar.next_time() < end) {
+        Entry entry = calendar.pop();
+        c.now = entry.time;
+        c.self = entry.instance;
+        StateMachine<TopState_>& state_machine = resolve(entry.instance);
+        visit([&](auto const& event) {
+          state_machine.template dispatch<std::remove_cv_t<std::remove_reference_t<decltype(event)>>>(event);
+        }, entry.event);
+        count++;
+      }
+      restore(route);
+      c = saved;
+      return count;
+    }
+
+    struct SavedRoute
+    {
+      void* channel;
+      bool (*push)(void*, Envelope<TopState_> const&);
+      std::atomic<bool>* ready;
+    };
+
+    // Routes send<TopState_>() from react() into the simulation.
+    SavedRoute bind() {
+      SavedRoute saved{Route<TopState_>::channel, Route<TopState_>::push, Route<TopState_>::ready};
+      Route<TopState_>::channel = this;
+      Route<TopState_>::push = [](void* channel, Envelope<TopState_> const& envelope) {
+        static_cast<Partition*>(channel)->send(envelope);
+        return true;
+      };
+      Route<TopState_>::ready = &ready;
+      return saved;
+    }
+
+    static void restore(SavedRoute const& saved) {
+      Route<TopState_>::channel = saved.channel;
+      Route<TopState_>::push = saved.push;
+      Route<TopState_>::ready = saved.ready;
+    }
+
+    void send(Envelope<TopState_> const& envelope) {
+      Context& c = context();
+      Partition& target = simulation->partition(envelope.instance);
+      const Entry entry{c.now + simulation->latency_, next_sequence(), envelope.instance, envelope.event};
+      if (c.parallel && &target != this) {
+        outbox.push_back(entry);
+      }
+      else {
+        target.calendar.push(entry);
+      }
+    }
+  };
+
+  struct Context
+  {
+    Simulation* simulation = nullptr;
+    Partition* partition = nullptr;
+    SimulationTime now = 0;
+    std::uint32_t self = 0;
+    bool parallel = false;
+  };
+
+  class Barrier
+  {
+  public:
+    explicit Barrier(std::size_t count) : count_{count} {}
+
+    void arrive_and_wait() {
+      std::unique_lock<std::mutex> lock{mutex_};
+      const std::size_t generation = generation_;
+      if (++waiting_ == count_) {
+        waiting_ = 0;
+        generation_++;
+        condition_.notify_all();
+      }
+      else {
+        condition_.wait(lock, [&] { return generation != generation_; });
+      }
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::size_t count_;
+    std::size_t waiting_ = 0;
+    std::size_t generation_ = 0;
+  };
+
+  static Context& context() {
+    static thread_local Context context;
+    return context;
+  }
+
+  Partition& partition(std::uint32_t instance) {
+    return partitions_[instance % partitions_.size()];
+  }
+
+  void merge_outboxes() {
+    for (auto& source : partitions_) {
+      for (auto const& entry : source.outbox) {
+        partition(entry.instance).calendar.push(entry);
+      }
+      source.outbox.clear();
+    }
+  }
+
+  // The next window starts at the earliest pending event and spans latency_
+  // ticks, the earliest a message sent in it can arrive.
+  void next_window(SimulationTime end) {
+    bool any = false;
+    SimulationTime start = 0;
+    for (auto& p : partitions_) {
+      if (!p.calendar.empty() && (!any || p.calendar.next_time() < start)) {
+        any = true;
+        start = p.calendar.next_time();
+      }
+    }
+    done_ = !any || start > end;
+    window_end_ = std::min(start + latency_, end + 1);
+  }
+
+  SimulationTime latency_;
+  std::vector<Partition> partitions_;
+  SimulationTime time_ = 0;
+  SimulationTime window_end_ = 0;
+  bool done_ = false;
+};
+
+}
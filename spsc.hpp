@@ -0,0 +1,102 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace metahsm {
+
+constexpr std::size_t cache_line_size = 64;
+
+// Bounded wait-free single-producer/single-consumer ring. push() is only called
+// from the producer thread, pop()/drain() only from the consumer thread; the
+// counters may be read from anywhere.
+template <typename T_, std::size_t Capacity_>
+class SpscChannel
+{
+public:
+  static_assert(Capacity_ > 0 && (Capacity_ & (Capacity_ - 1)) == 0, "capacity must be a power of two");
+  static constexpr std::size_t capacity = Capacity_;
+
+  bool push(T_ const& value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == Capacity_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == Capacity_) {
+        rejected_.store(rejected_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    slots_[tail & (Capacity_ - 1)] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T_& value) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) {
+        return false;
+      }
+    }
+    value = slots_[head & (Capacity_ - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Hands up to max_count elements to fun in place and releases their slots
+  // with a single store. Returns the number of elements consumed.
+  template <typename Callable_>
+  std::size_t drain(Callable_ && fun, std::size_t max_count = Capacity_) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    tail_cache_ = tail_.load(std::memory_order_acquire);
+    std::size_t count = tail_cache_ - head;
+    count = count < max_count ? count : max_count;
+    for (std::size_t i = 0; i < count; i++) {
+      fun(slots_[(head + i) & (Capacity_ - 1)]);
+    }
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  std::size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  std::size_t pushed() const {
+    return tail_.load(std::memory_order_relaxed);
+  }
+
+  std::size_t rejected() const {
+    return rejected_.load(std::memory_order_relaxed);
+  }
+
+private:
+  alignas(cache_line_size) std::atomic<std::size_t> head_{0};
+  std::size_t tail_cache_{0};
+  alignas(cache_line_size) std::atomic<std::size_t> tail_{0};
+  std::size_t head_cache_{0};
+  std::atomic<std::size_t> rejected_{0};
+  alignas(cache_line_size) std::array<T_, Capacity_> slots_{};
+};
+
+}
@@ -1,145 +1,795 @@
 #include <iostream>
 #include <cassert>
-#include "metahsm.hpp"
+#include <thread>
+#include <future>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#define LIFECYCLE_LOG(text) (std::cout << text << std::endl)
+#include "lifecycle.hpp"
+#include "bus.hpp"
+#include "coroutine.hpp"
+#include "interpreter.hpp"
+#include "simulation.hpp"
+#include "inbox.hpp"
+#include "resident.hpp"
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "shard.hpp"
+#endif
 
 
 
 using namespace metahsm;
-enum LifecycleEvent
+template <typename Config>
+struct TLC : StateTemplate<TLC>, Config
+{
+  struct Unconfigured : State, Config
+  {
+    inline void react(Event<CONFIGURE>) {
+      transition<Inactive>();
+    }
+  };
+  using Inactive = typename Config::Inactive;
+  using SubStates = std::tuple<Unconfigured, Inactive>;
+};
+
+struct Inactive1;
+struct TLCConfig1 : Config<TLCConfig1>
+{
+  using Inactive = Inactive1;
+};
+struct Inactive1 : State<TLC<TLCConfig1>>
+{
+  inline void react(Event<ACTIVATE>) { };
+};
+
+struct Inactive2;
+struct TLC2TopState;
+struct TLCConfig2 : Config<TLCConfig2>
+{
+  using Inactive = Inactive2;
+  using TopState = TLC2TopState;
+};
+
+struct TLC2TopState : State<TLC2TopState>
+{
+  using SubStates = std::tuple<TLC<TLCConfig2>>;
+};
+
+struct Inactive2 : State<TLC2TopState>
 {
-  CONFIGURE,
-  CLEANUP,
-  ACTIVATE,
-  DEACTIVATE
+  inline void react(Event<ACTIVATE>) { };
 };
 
-template <auto e>
-struct Event{};
 
-struct LifecycleTopState : State<LifecycleTopState>
+struct JunctionTopState : State<JunctionTopState>
 {
-  struct Unconfigured : State
+  static constexpr std::size_t max_completion_steps = 4;
+  struct Idle : State
   {
-    void react(Event<CONFIGURE>); // -> Inactive
+    inline void react(Event<CONFIGURE>) { transition<Choice>(); }
+    inline void react(Event<ACTIVATE>) { transition<Ping>(); }
   };
-  struct Inactive : State
+  struct Choice : State
   {
-    void react(Event<ACTIVATE>); // -> Active
+    inline void react(Completion) { transition<Junction>(); }
   };
-  struct Active : State
+  struct Junction : State
   {
-    inline void react(Event<DEACTIVATE>) {
-      transition<Inactive>();
+    inline void react(Completion) { transition<Done>(); }
+  };
+  struct Done : State
+  { };
+  struct Ping : State
+  {
+    inline void react(Completion) { transition<Pong>(); }
+  };
+  struct Pong : State
+  {
+    inline void react(Completion) { transition<Ping>(); }
+  };
+  using SubStates = std::tuple<Idle, Choice, Junction, Done, Ping, Pong>;
+};
+
+struct Sample
+{
+  static constexpr std::uint16_t wire_id = 0x0101;
+  std::uint16_t value;
+};
+
+struct Reset
+{
+  static constexpr std::uint16_t wire_id = 0x7f00;
+};
+
+// 8-byte aligned, without a default constructor
+struct Stamp
+{
+  static constexpr std::uint16_t wire_id = 0x0200;
+  explicit Stamp(std::uint64_t ns) : ns{ns} {}
+  std::uint64_t ns;
+};
+
+// no state reacts to it
+struct Unwired
+{
+  static constexpr std::uint16_t wire_id = 0x0300;
+};
+
+struct WireTopState : State<WireTopState>
+{
+  using WireEvents = std::tuple<Sample, Reset, Stamp, Unwired>;
+  struct Sampling : State
+  {
+    inline void react(Sample const& sample) {
+      context<WireTopState>().sum += sample.value;
+    }
+    inline void react(Reset) { transition<Sampling>(); }
+    inline void react(Stamp const& stamp) {
+      context<WireTopState>().stamp = stamp.ns;
+      context<WireTopState>().stamp_address = &stamp;
+    }
+  };
+  using SubStates = std::tuple<Sampling>;
+  int sum = 0;
+  std::uint64_t stamp = 0;
+  const void* stamp_address = nullptr;
+};
+
+struct ConnectionTopState : State<ConnectionTopState>
+{
+  using Mailbox = std::variant<Event<ACTIVATE>, Event<DEACTIVATE>>;
+  struct Closed : State
+  {
+    inline void react(Event<ACTIVATE>) { transition<Open>(); }
+  };
+  struct Open : State
+  {
+    inline void react(Event<DEACTIVATE>) { transition<Closed>(); }
+  };
+  using SubStates = std::tuple<Closed, Open>;
+};
+
+struct SupervisorTopState : State<SupervisorTopState>
+{
+  using Mailbox = std::variant<Event<CONFIGURE>>;
+  struct Running : State
+  {
+    inline void react(Event<ACTIVATE>) {
+      send<ConnectionTopState>(Event<ACTIVATE>{}, 1);
+    }
+  };
+  using SubStates = std::tuple<Running>;
+};
+
+struct AsyncTopState : State<AsyncTopState>
+{
+  static constexpr std::size_t max_deferred_events = 4;
+  struct Idle : State
+  {
+    inline void react(Event<ACTIVATE>) {
+      transition<Flushed>();
+      transition_action([this] { return context<AsyncTopState>().flush.get_future(); });
     }
-    int i = 0;
-    struct Operation : Region
+  };
+  struct Flushed : State
+  {
+    inline void react(Event<DEACTIVATE>) { transition<Idle>(); }
+  };
+  using SubStates = std::tuple<Idle, Flushed>;
+  std::promise<void> flush;
+};
+
+#if defined(__cpp_impl_coroutine)
+struct Ack
+{
+  int sequence;
+};
+
+struct Timeout
+{};
+
+struct ProtocolTopState : State<ProtocolTopState>
+{
+  struct Handshake : CoroutineState<Handshake, State, 256, Ack, Timeout>
+  {
+    Script run() {
+      auto& log = context<ProtocolTopState>().log;
+      log.push_back(0);
+      Ack first = co_await receive<Ack>();
+      log.push_back(first.sequence);
+      auto second = co_await receive<Ack, Timeout>();
+      if (std::holds_alternative<Timeout>(second)) {
+        transition<Failed>();
+        co_return;
+      }
+      log.push_back(std::get<Ack>(second).sequence);
+      transition<Established>();
+    }
+  };
+  struct Established : State
+  {
+    inline void react(Event<DEACTIVATE>) { transition<Handshake>(); }
+  };
+  struct Failed : State
+  { };
+  using SubStates = std::tuple<Handshake, Established, Failed>;
+  std::vector<int> log;
+};
+#endif
+
+struct EntryTopState : State<EntryTopState>
+{
+  struct Idle : State
+  {
+    inline void on_entry() { context<EntryTopState>().entries++; }
+  };
+  using SubStates = std::tuple<Idle>;
+  int entries = 0;
+};
+
+struct DoorTopState : State<DoorTopState>
+{
+  struct Closed : State
+  {
+    int attempts = 0;
+  };
+  struct Open : State
+  { };
+  struct Locked : State
+  {
+    inline bool react(Event<ACTIVATE>) { return transition<Closed>(); }
+  };
+  struct Unlocked
+  {
+    bool operator()(Closed& closed, Event<ACTIVATE> const&) const { return ++closed.attempts > 1; }
+  };
+  struct Count
+  {
+    void operator()(Closed& closed, Event<DEACTIVATE> const&) const { closed.context<DoorTopState>().locks++; }
+  };
+  using SubStates = std::tuple<Closed, Open, Locked>;
+  using Transitions = std::tuple<
+    Transition<Closed, Event<ACTIVATE>, Open, Unlocked>,
+    Transition<Closed, Event<DEACTIVATE>, Locked, void, Count>,
+    Transition<Open, Event<DEACTIVATE>, Closed>>;
+  int locks = 0;
+};
+
+// Two regions target diverging states of a third region while a fourth stays
+// untouched: the second transition is still rejected.
+struct SplitTopState : State<SplitTopState>
+{
+  struct Lane : Region
+  {
+    struct Behind : State
+    { };
+    struct Ahead : State
+    {
+      inline void react(Event<ACTIVATE>) { transition<Behind>(); }
+    };
+    using SubStates = std::tuple<Ahead, Behind>;
+  };
+  struct Driver : Region
+  {
+    struct Steering : State
+    {
+      inline void react(Event<ACTIVATE>) { transition<Lane::Ahead>(); }
+    };
+    using SubStates = std::tuple<Steering>;
+  };
+  struct Spare : Region
+  {
+    struct Idle : State
+    { };
+    using SubStates = std::tuple<Idle>;
+  };
+  using Regions = std::tuple<Lane, Driver, Spare>;
+};
+
+static_assert(!is_valid<SplitTopState>(transition_branch_v<SplitTopState::Lane::Behind>,
+    transition_branch_v<SplitTopState::Lane::Ahead>));
+
+// A row whose transition conflicts with an earlier one does not fire.
+struct RowConflictTopState : State<RowConflictTopState>
+{
+  struct Tally
+  {
+    template <typename State_>
+    void operator()(State_& state, Event<ACTIVATE> const&) const { state.template context<RowConflictTopState>().actions++; }
+  };
+  struct Running : State
+  {
+    struct Left : Region
     {
-      struct Monitoring : State
+      struct Down;
+      struct Up : State
       {
-        inline void react(Event<ACTIVATE>) {
-          transition<Commanding>();
-          transition_action(&Monitoring::action);
-        }
-        inline void action() { std::cout << "Action!" << std::endl; }
+        inline void react(Event<ACTIVATE>) { transition<Down>(); }
       };
-      struct Commanding : State
+      struct Down : State
+      { };
+      using SubStates = std::tuple<Up, Down>;
+    };
+    struct Right : Region
+    {
+      struct Fast : State
+      { };
+      using SubStates = std::tuple<Fast>;
+    };
+    using Regions = std::tuple<Left, Right>;
+  };
+  using SubStates = std::tuple<Running>;
+  using Transitions = std::tuple<Transition<Running::Right::Fast, Event<ACTIVATE>, Running::Left::Up, void, Tally>>;
+  int actions = 0;
+};
+
+static_assert(transition_masks_v<LifecycleTopState, LifecycleTopState::Active::Safety::Error>.size() == 2);
+
+// Branches conflict iff they diverge inside one region; untouched regions do
+// not make them valid.
+static_assert(!is_valid<LifecycleTopState>(transition_branch_v<LifecycleTopState::Active::Operation::Commanding>,
+    transition_branch_v<LifecycleTopState::Active::Operation::Monitoring>));
+static_assert(is_valid<LifecycleTopState>(transition_branch_v<LifecycleTopState::Active::Operation::Commanding>,
+    transition_branch_v<LifecycleTopState::Active::Safety::Error>));
+static_assert(!is_valid<LifecycleTopState>(transition_branch_v<LifecycleTopState::Inactive>,
+    transition_branch_v<LifecycleTopState::Active::Safety::Error>));
+
+using Lifecycle = LifecycleTopState;
+static_assert(std::is_same_v<depth_first_states_t<Lifecycle>, std::tuple<Lifecycle, Lifecycle::Unconfigured,
+    Lifecycle::Inactive, Lifecycle::Active, Lifecycle::Active::Operation, Lifecycle::Active::Operation::Monitoring,
+    Lifecycle::Active::Operation::Commanding, Lifecycle::Active::Safety, Lifecycle::Active::Safety::Ok,
+    Lifecycle::Active::Safety::Error>>);
+static_assert(!is_always_valid_v<DoorTopState, DoorTopState::Open>);
+
+// Two regions requesting conflicting transitions on the same event.
+template <typename Config>
+struct Arbiter : StateTemplate<Arbiter>, Config
+{
+  struct Running : State, Config
+  {
+    struct Sensor : Region, Config
+    {
+      struct Watching : State, Config
       {
-        inline void react(Event<CLEANUP>) { 
-          std::cout << "Before Action1!" << std::endl;
-          transition<Monitoring>();
-          transition<Safety::Error>();
-          transition_action([this](){ std::cout << "Action1!" << std::endl; });
+        inline void react(Event<DEACTIVATE>) {
+          context<Arbiter>().accepted += transition<Stopped>();
+          transition_action([this] { context<Arbiter>().actions++; });
         }
       };
-      using SubStates = std::tuple<Monitoring, Commanding>;
+      using SubStates = std::tuple<Watching>;
     };
-    struct Safety : Region
+    struct Operator : Region, Config
     {
-      struct Ok : State
+      static constexpr int priority = 1;
+      struct Driving : State, Config
       {
-        inline void react(Event<CLEANUP>) {
-          std::cout << "Before Action3!" << std::endl;
-          transition_action([this](){ std::cout << "Action3!" << std::endl; });
-        }
+        struct Manual : State, Config
+        {
+          inline void react(Event<DEACTIVATE>) { transition<Paused>(); }
+        };
+        using SubStates = std::tuple<Manual>;
       };
-      struct Error : State
-      { };
-      using SubStates = std::tuple<Ok, Error>;
+      using SubStates = std::tuple<Driving>;
     };
-    using Regions = std::tuple<Operation, Safety>;
+    using Regions = std::tuple<Sensor, Operator>;
   };
-  using SubStates = std::tuple<Unconfigured, Inactive, Active>;
+  struct Stopped : State, Config
+  { };
+  struct Paused : State, Config
+  { };
+  using SubStates = std::tuple<Running, Stopped, Paused>;
+  int actions = 0;
+  int accepted = 0;
 };
 
-void LifecycleTopState::Unconfigured::react(Event<CONFIGURE>) {
-  transition<Inactive>();
-  auto& active_context = context<Active>();
-  active_context.i = 1;
-}
+template <typename Policy_>
+struct ArbiterConfig : Config<ArbiterConfig<Policy_>>
+{
+  using ConflictPolicy = Policy_;
+};
 
-void LifecycleTopState::Inactive::react(Event<ACTIVATE>) {
-  transition<History<Active>>();
-  assert(is_in_state<Inactive>());
-}
+struct UnarbitratedConfig : Config<UnarbitratedConfig>
+{};
 
+template <typename Policy_>
+using ArbiterOf = Arbiter<ArbiterConfig<Policy_>>;
+
+// The same sub-machine on typed wrappers and on the shared engine, as two
+// regions of one machine: both must walk the same states.
 template <typename Config>
-struct TLC : StateTemplate<TLC>, Config
+struct Session : StateTemplate<Session>, Config
 {
-  struct Unconfigured : State, Config
+  static constexpr bool shared_body = Config::shared;
+  struct Closed : State, Config
   {
-    inline void react(Event<CONFIGURE>) {
-      transition<Inactive>();
-    }
+    inline void on_entry() { context<Session>().log = context<Session>().log * 31 + 1; }
+    inline void react(Event<CONFIGURE>) { transition<Open>(); }
+    inline void react(Event<ACTIVATE>) { transition<typename History<Open>::Deep>(); }
   };
-  using Inactive = typename Config::Inactive;
-  using SubStates = std::tuple<Unconfigured, Inactive>;
+  struct Open : State, Config
+  {
+    struct Handshake : State, Config
+    {
+      inline void react(Event<ACTIVATE>) { transition<typename Streaming::Slow>(); }
+    };
+    struct Streaming : State, Config
+    {
+      struct Slow : State, Config
+      {
+        inline void on_exit() { context<Session>().log = context<Session>().log * 31 + 2; }
+        inline bool react(Event<ACTIVATE>) { return transition<Fast>(); }
+      };
+      struct Fast : State, Config
+      {
+        inline void on_entry() { context<Session>().log = context<Session>().log * 31 + 3; }
+      };
+      inline void on_exit() { context<Session>().log = context<Session>().log * 31 + 4; }
+      inline void react(Event<DEACTIVATE>) { transition<Open>(); }
+      using SubStates = std::tuple<Slow, Fast>;
+    };
+    inline void react(Event<CLEANUP>) { transition<Closed>(); }
+    inline void react(Event<DEACTIVATE>) { context<Session>().log = context<Session>().log * 31 + 5; }
+    using SubStates = std::tuple<Handshake, Streaming>;
+  };
+  using SubStates = std::tuple<Closed, Open>;
+  unsigned log = 0;
 };
 
-struct Inactive1;
-struct TLCConfig1 : Config<TLCConfig1>
+template <bool Shared_>
+struct SessionConfig;
+
+struct SessionTopState : State<SessionTopState>
 {
-  using Inactive = Inactive1;
+  using Regions = std::tuple<Session<SessionConfig<false>>, Session<SessionConfig<true>>>;
 };
-struct Inactive1 : State<TLC<TLCConfig1>>
+
+template <bool Shared_>
+struct SessionConfig : TopStateRebind<SessionTopState>
 {
-  inline void react(Event<ACTIVATE>) { };
+  static constexpr bool shared = Shared_;
 };
 
-struct Inactive2;
-struct TLC2TopState;
-struct TLCConfig2 : Config<TLCConfig2>
+template <template <typename> typename Pick_>
+bool same_session_state(StateMachine<SessionTopState> & sm) {
+  return sm.is_in_state<Pick_<Session<SessionConfig<false>>>>() == sm.is_in_state<Pick_<Session<SessionConfig<true>>>>();
+}
+
+template <typename Session_> using SessionClosed = typename Session_::Closed;
+template <typename Session_> using SessionHandshake = typename Session_::Open::Handshake;
+template <typename Session_> using SessionSlow = typename Session_::Open::Streaming::Slow;
+template <typename Session_> using SessionFast = typename Session_::Open::Streaming::Fast;
+
+static_assert(std::is_same_v<wrapper_t<Session<SessionConfig<true>>>, SharedCompositeWrapper<Session<SessionConfig<true>>>>);
+static_assert(std::is_same_v<wrapper_t<Session<SessionConfig<false>>>, CompositeStateWrapper<Session<SessionConfig<false>>>>);
+
+struct PublishedTopState : State<PublishedTopState>
 {
-  using Inactive = Inactive2;
-  using TopState = TLC2TopState;
+  static constexpr bool publish_configuration = true;
+  static constexpr std::size_t max_subscribers = 2;
+  struct Idle : State
+  {
+    inline void react(Event<ACTIVATE>) { transition<Busy>(); }
+  };
+  struct Busy : State
+  {
+    struct Loading : State
+    {
+      inline void react(Event<CONFIGURE>) { transition<Saving>(); }
+    };
+    struct Saving : State
+    { };
+    inline void react(Event<DEACTIVATE>) { transition<Idle>(); }
+    using SubStates = std::tuple<Loading, Saving>;
+  };
+  using SubStates = std::tuple<Idle, Busy>;
 };
 
-struct TLC2TopState : State<TLC2TopState>
+struct ResidentTopState : State<ResidentTopState>
 {
-  using SubStates = std::tuple<TLC<TLCConfig2>>;
+  static constexpr bool resident_configuration = true;
+  struct Counters
+  {
+    std::uint32_t activations;
+    std::uint16_t cleanups;
+  };
+  using ResidentData = Counters;
+  Counters resident_data() const { return counters; }
+  struct Idle : State
+  {
+    inline void react(Event<ACTIVATE>) {
+      context<ResidentTopState>().counters.activations++;
+      transition<Busy>();
+    }
+  };
+  struct Busy : State
+  {
+    struct Loading : State
+    {
+      inline void react(Event<CONFIGURE>) { transition<Saving>(); }
+    };
+    struct Saving : State
+    { };
+    inline void react(Event<CLEANUP>) { context<ResidentTopState>().counters.cleanups++; }
+    inline void react(Event<DEACTIVATE>) { transition<Idle>(); }
+    using SubStates = std::tuple<Loading, Saving>;
+  };
+  using SubStates = std::tuple<Idle, Busy>;
+  Counters counters{};
 };
 
-struct Inactive2 : State<TLC2TopState>
+enum MediaEvent
 {
-  inline void react(Event<ACTIVATE>) { };
+  POWER,
+  PLAY,
+  STOP,
+  SPEED,
+  VOLUME
 };
 
+// Table-only machine, also run by the interpreter.
+struct MediaTopState : State<MediaTopState>
+{
+  struct Off : State
+  { };
+  struct On : State
+  {
+    struct Media : Region
+    {
+      struct Stopped : State
+      { };
+      struct Playing : State
+      {
+        struct Normal : State
+        { };
+        struct Fast : State
+        { };
+        using SubStates = std::tuple<Normal, Fast>;
+      };
+      using SubStates = std::tuple<Stopped, Playing>;
+    };
+    struct Volume : Region
+    {
+      struct Quiet : State
+      { };
+      struct Loud : State
+      { };
+      using SubStates = std::tuple<Quiet, Loud>;
+    };
+    using Regions = std::tuple<Media, Volume>;
+  };
+  using SubStates = std::tuple<Off, On>;
 
-template <typename Config>
-struct TLC3 : StateTemplate<TLC3>, Config
+  struct LoudAllowed
+  {
+    bool operator()(On::Volume::Quiet& quiet, Event<VOLUME> const&) const { return quiet.context<MediaTopState>().loud_allowed; }
+  };
+  struct Quieten
+  {
+    void operator()(On::Volume::Loud& loud, Event<VOLUME> const&) const { loud.context<MediaTopState>().quietened++; }
+  };
+  using Transitions = std::tuple<
+    Transition<Off, Event<POWER>, History<On>::Deep>,
+    Transition<On, Event<POWER>, Off>,
+    Transition<On::Media::Stopped, Event<PLAY>, On::Media::Playing>,
+    Transition<On::Media::Playing, Event<STOP>, On::Media::Stopped>,
+    Transition<On::Media::Playing::Normal, Event<SPEED>, On::Media::Playing::Fast>,
+    Transition<On::Media::Playing::Fast, Event<SPEED>, On::Media::Playing::Normal>,
+    Transition<On::Volume::Quiet, Event<VOLUME>, On::Volume::Loud, LoudAllowed>,
+    Transition<On::Volume::Loud, Event<VOLUME>, On::Volume::Quiet, void, Quieten>>;
+  bool loud_allowed = false;
+  int quietened = 0;
+};
+
+using MediaEvents = std::tuple<Event<POWER>, Event<PLAY>, Event<STOP>, Event<SPEED>, Event<VOLUME>>;
+
+// Each instance ticks every 10 ticks of virtual time and pings its neighbour.
+struct TickerTopState : State<TickerTopState>
 {
-  struct Unconfigured : State, Config
+  using Mailbox = std::variant<Event<ACTIVATE>, Event<CONFIGURE>>;
+  using Clock = Simulation<TickerTopState>;
+  struct Ticking : State
   {
-    inline void react(Event<CONFIGURE>) {
-      transition<Unconfigured>();
+    inline void react(Event<ACTIVATE>) {
+      auto& top = context<TickerTopState>();
+      top.last_tick = Clock::now();
+      if (++top.ticks == 5) {
+        transition<Stopped>();
+        return;
+      }
+      Clock::after(10, Event<ACTIVATE>{});
+      send<TickerTopState>(Event<CONFIGURE>{}, Clock::self() ^ 1);
     }
   };
-  using SubStates = std::tuple<Unconfigured>;
+  struct Stopped : State
+  { };
+  inline void react(Event<CONFIGURE>) { pings++; }
+  using SubStates = std::tuple<Ticking, Stopped>;
+  using HotStates = std::tuple<Ticking>;
+  using ColdStates = std::tuple<Stopped>;
+  int ticks = 0;
+  int pings = 0;
+  SimulationTime last_tick = 0;
+};
+
+static_assert(std::is_same_v<storage_order_t<TickerTopState>, std::tuple<TickerTopState::Ticking, TickerTopState>>);
+
+// Status and Reading have no default constructor: their lanes never make one.
+struct Status
+{
+  static constexpr QueuePolicy queue_policy = QueuePolicy::coalesce_latest;
+  Status(int value) : value(value) {}
+  int value;
+};
+
+struct Reading
+{
+  static constexpr QueuePolicy queue_policy = QueuePolicy::drop_oldest;
+  Reading(int value) : value(value) {}
+  int value;
 };
-struct TLC3TopState : State<TLC3TopState>
+
+struct Poke
 {
-  using Regions = std::tuple<TLC3<TopStateRebind<TLC3TopState>>>;
+  static constexpr QueuePolicy queue_policy = QueuePolicy::drop_unhandled;
 };
 
+// Armed by Event<ACTIVATE>; only Armed reacts to Poke.
+struct SensorTopState : State<SensorTopState>
+{
+  using Mailbox = std::variant<Poke, Status, Reading, Event<ACTIVATE>>;
+  struct Idle : State
+  {
+    inline void react(Event<ACTIVATE>) { transition<Armed>(); }
+  };
+  struct Armed : State
+  {
+    inline void react(Poke) { context<SensorTopState>().pokes++; }
+  };
+  inline void react(Status const& status) { statuses.push_back(status.value); }
+  inline void react(Reading const& reading) { samples.push_back(reading.value); }
+  using SubStates = std::tuple<Idle, Armed>;
+  std::vector<int> statuses;
+  std::vector<int> samples;
+  int pokes = 0;
+};
+
+// Legacy, Running::Turbo and Diagnostics are never targeted and get pruned.
+struct PrunedTopState : State<PrunedTopState>
+{
+  static constexpr bool prune_unreachable = true;
+  struct Running;
+  struct Idle : State
+  {
+    using Targets = std::tuple<Running>;
+    inline void react(Event<ACTIVATE>) { transition<Running>(); }
+  };
+  struct Legacy : State
+  {
+    struct Old : State
+    { };
+    struct Older : State
+    { };
+    using SubStates = std::tuple<Old, Older>;
+  };
+  struct Running : State
+  {
+    struct Fast;
+    struct Slow : State
+    {
+      using Targets = std::tuple<Fast>;
+      inline void react(Event<CONFIGURE>) { transition<Fast>(); }
+    };
+    struct Fast : State
+    { };
+    struct Turbo : State
+    { };
+    using SubStates = std::tuple<Slow, Fast, Turbo>;
+  };
+  struct Diagnostics : State
+  { };
+  struct Stopped : State
+  { };
+  using SubStates = std::tuple<Idle, Legacy, Running, Diagnostics, Stopped>;
+  using Transitions = std::tuple<Transition<Running, Event<DEACTIVATE>, Stopped>>;
+};
+
+static_assert(std::is_same_v<pruned_states_t<PrunedTopState>, std::tuple<PrunedTopState::Legacy, PrunedTopState::Legacy::Old,
+    PrunedTopState::Legacy::Older, PrunedTopState::Running::Turbo, PrunedTopState::Diagnostics>>);
+static_assert(std::tuple_size_v<all_states_t<PrunedTopState>> == 6);
+static_assert(std::tuple_size_v<pruned_states_t<LifecycleTopState>> == 0);
+
+#if defined(__linux__)
+// What a forked shard worker leaves in a shared mapping for the test.
+struct ShardResult
+{
+  ShardMetrics metrics;
+  int sums[4];
+};
+
+// Two worker processes with four WireTopState machines each, fed by a router
+// in this process over the links make_pair() returns.
+template <typename Link_, typename MakePair_>
+void test_sharding(char const* name, MakePair_ make_pair) {
+  constexpr std::size_t shards = 2, machines = 8, per_shard = machines / shards;
+  void* mapping = mmap(nullptr, sizeof(ShardResult) * shards, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(mapping != MAP_FAILED);
+  auto* results = static_cast<ShardResult*>(mapping);
+  std::cout.flush();
+  std::vector<Link_> links;
+  std::vector<pid_t> workers;
+  for (std::size_t shard = 0; shard < shards; shard++) {
+    auto [router_end, worker_end] = make_pair();
+    assert(router_end && worker_end);
+    const pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      ShardWorker<Link_> worker{std::move(worker_end)};
+      StateMachine<WireTopState> local[per_shard];
+      worker.run([&](std::uint32_t instance) {
+        const std::size_t index = shard_index(instance, shards);
+        return index < per_shard ? &local[index] : nullptr;
+      });
+      results[shard].metrics = worker.metrics();
+      for (std::size_t i = 0; i < per_shard; i++) {
+        results[shard].sums[i] = local[i].get_state<WireTopState>().sum;
+      }
+      _exit(0);
+    }
+    workers.push_back(pid);
+    links.push_back(std::move(router_end));
+  }
+
+  // small batches, so that each shard gets many
+  ShardRouter<Link_> router{std::move(links), 256};
+  int expected[machines]{};
+  [[maybe_unused]] bool written = true;
+  for (int round = 0; round < 250; round++) {
+    for (std::uint32_t i = 0; i < machines; i++) {
+      const std::uint16_t value = (round + i) % 7;
+      written = router.send(i, Sample{value}) && written;
+      expected[i] += value;
+    }
+  }
+  written = router.send(81, Sample{1}) && written; // shard 1 has no machine 81
+  written = router.send(3, Reset{}) && written;
+  written = router.send(2, Unwired{}) && written; // ignored by machine 2 on shard 0
+  written = router.close() && written;
+  assert(written);
+  for (pid_t pid : workers) {
+    int status;
+    [[maybe_unused]] const pid_t exited = waitpid(pid, &status, 0);
+    assert(exited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  for (std::size_t shard = 0; shard < shards; shard++) {
+    [[maybe_unused]] ShardMetrics const& sent = router.metrics(shard);
+    ShardMetrics const& received = results[shard].metrics;
+    assert(sent.events == (shard ? 1002 : 1001) && sent.rejected == 0 && sent.batches > 1);
+    assert(received.events == 1000 + shard && received.ignored == 1 - shard && received.rejected == shard);
+    assert(received.batches == sent.batches && received.bytes == sent.bytes);
+    std::cout << name << " shard " << shard << ": " << received.batches << " batches, "
+        << received.events_per_second() << " events/s, " << received.mean_latency_ns() << " ns mean latency" << std::endl;
+  }
+  for (std::uint32_t i = 0; i < machines; i++) {
+    assert(results[shard_of(i, shards)].sums[shard_index(i, shards)] == expected[i]);
+  }
+  munmap(results, sizeof(ShardResult) * shards);
+}
+#endif
+
+#if defined(__cpp_constinit)
+constinit
+#endif
+StateMachine<LifecycleTopState> boot_machine{deferred_start};
+
+#if defined(__cpp_constinit)
+constinit
+#endif
+StateMachine<EntryTopState> entry_machine{deferred_start};
+
 template <typename T1, typename T2>
 void ass() {
     static_assert(std::is_same_v<T1,T2>);
@@ -161,6 +811,536 @@ int main(int , char *[]) {
   sm.dispatch<Event<ACTIVATE>>();
   sm.dispatch<Event<CLEANUP>>();
   sm.dispatch<Event<ACTIVATE>>();
+
+  StateMachine<JunctionTopState> smj;
+  smj.dispatch<Event<CONFIGURE>>();
+  assert(smj.is_in_state<JunctionTopState::Done>() && smj.is_stable());
+
+  StateMachine<JunctionTopState> smj2;
+  smj2.dispatch<Event<ACTIVATE>>();
+  assert(smj2.is_in_state<JunctionTopState::Ping>() && !smj2.is_stable());
+
+  StateMachine<WireTopState> smw;
+  static_assert(wire_frame_size_v<Sample> == 4 && wire_frame_size_v<Reset> == 3);
+  static_assert(wire_payload_offset_v<Stamp> == 8 && wire_frame_size_v<Stamp> == 16);
+  alignas(8) std::byte frame[16];
+  std::uint16_t id = Sample::wire_id, value = 5;
+  std::memcpy(frame, &id, 2);
+  std::memcpy(frame + 2, &value, 2);
+  [[maybe_unused]] WireStatus status = smw.dispatch_bytes(frame, 4);
+  assert(status == WireStatus::reacted);
+  status = smw.dispatch_bytes(frame, 3);
+  assert(status == WireStatus::rejected);
+  id = 0x0102;
+  std::memcpy(frame, &id, 2);
+  status = smw.dispatch_bytes(frame, 4);
+  assert(status == WireStatus::rejected);
+  id = Reset::wire_id;
+  std::memcpy(frame, &id, 2);
+  status = smw.dispatch_bytes(frame, 3);
+  assert(status == WireStatus::reacted);
+  assert(smw.get_state<WireTopState>().sum == 5);
+  [[maybe_unused]] std::size_t frame_size = write_wire_frame(Stamp{42}, frame);
+  assert(frame_size == 16);
+  status = smw.dispatch_bytes(frame, 16);
+  assert(status == WireStatus::reacted && smw.get_state<WireTopState>().stamp == 42);
+  // aligned payloads are read in place, misaligned ones are copied
+  assert(smw.get_state<WireTopState>().stamp_address == frame + wire_payload_offset_v<Stamp>);
+  alignas(8) std::byte misaligned[17];
+  std::memcpy(misaligned + 1, frame, 16);
+  status = smw.dispatch_bytes(misaligned + 1, 16);
+  assert(status == WireStatus::reacted && smw.get_state<WireTopState>().stamp == 42);
+  assert(smw.get_state<WireTopState>().stamp_address != misaligned + 1 + wire_payload_offset_v<Stamp>);
+  frame_size = write_wire_frame(Unwired{}, frame);
+  assert(frame_size == 3);
+  status = smw.dispatch_bytes(frame, 3);
+  assert(status == WireStatus::ignored);
+  StateMachine<LifecycleTopState> unwired;
+  status = unwired.dispatch_bytes(frame, 3);
+  assert(status == WireStatus::rejected);
+
+  StateMachine<LifecycleTopState> smb;
+  using LifecycleEvents = std::variant<Event<CONFIGURE>, Event<ACTIVATE>, Event<CLEANUP>>;
+  LifecycleEvents batch[] = {Event<CLEANUP>{}, Event<CONFIGURE>{}, Event<ACTIVATE>{}};
+  bool results[3]{};
+  [[maybe_unused]] std::size_t reacted = smb.dispatch_batch(batch, 3, results);
+  assert(reacted == 2 && !results[0] && results[1] && results[2]);
+  assert(smb.is_in_state<LifecycleTopState::Active::Operation::Monitoring>());
+  StateMachine<LifecycleTopState> smb_array;
+  reacted = smb_array.dispatch_batch(batch);
+  assert(reacted == 2 && smb_array.active_states() == smb.active_states());
+#if defined(__cpp_lib_span)
+  StateMachine<LifecycleTopState> smb_span;
+  reacted = smb_span.dispatch_batch(std::span{batch}, results);
+  assert(reacted == 2 && smb_span.active_states() == smb.active_states());
+#endif
+
+  Bus<4, 1, ConnectionTopState, SupervisorTopState> bus;
+  StateMachine<ConnectionTopState> connections[2];
+  std::thread worker([&]{
+    bus.bind(0);
+    StateMachine<SupervisorTopState> supervisor;
+    supervisor.dispatch<Event<ACTIVATE>>();
+  });
+  bus.wait<ConnectionTopState>();
+  worker.join();
+  [[maybe_unused]] const std::size_t drained = bus.drain<ConnectionTopState>([&](std::uint32_t i) -> auto& { return connections[i]; });
+  assert(drained == 1);
+  assert(connections[1].is_in_state<ConnectionTopState::Open>());
+  assert(bus.sent<ConnectionTopState>(0) == 1 && bus.rejected<ConnectionTopState>(0) == 0);
+  {
+    // a waiting consumer never misses the wakeup of a producer
+    constexpr std::size_t messages = 200000;
+    Bus<4, 1, ConnectionTopState> stress_bus;
+    StateMachine<ConnectionTopState> connection;
+    std::thread producer([&] {
+      stress_bus.bind(0);
+      for (std::size_t i = 0; i < messages; i++) {
+        const auto event = i % 2 ? mailbox_t<ConnectionTopState>{Event<DEACTIVATE>{}} : Event<ACTIVATE>{};
+        while (!Route<ConnectionTopState>::send(event, 0)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    std::size_t received = 0;
+    while (received < messages) {
+      stress_bus.wait<ConnectionTopState>();
+      received += stress_bus.drain(connection, 3);
+    }
+    producer.join();
+    assert(received == messages && connection.is_in_state<ConnectionTopState::Closed>());
+  }
+
+  StateMachine<AsyncTopState> sma;
+  sma.dispatch<Event<ACTIVATE>>();
+  assert(sma.is_in_transition());
+  // deferred while the action runs
+  [[maybe_unused]] bool accepted = sma.dispatch<Event<DEACTIVATE>>();
+  assert(accepted);
+  [[maybe_unused]] bool completed = sma.poll();
+  assert(!completed);
+  sma.get_state<AsyncTopState>().flush.set_value();
+  completed = sma.poll();
+  assert(completed);
+  assert(!sma.is_in_transition() && sma.is_in_state<AsyncTopState::Idle>());
+  // a failed action completes the transition, then poll() rethrows
+  sma.get_state<AsyncTopState>().flush = std::promise<void>{};
+  sma.dispatch<Event<ACTIVATE>>();
+  sma.get_state<AsyncTopState>().flush.set_exception(std::make_exception_ptr(std::runtime_error{"flush failed"}));
+  [[maybe_unused]] bool rethrown = false;
+  try {
+    sma.poll();
+  }
+  catch(std::runtime_error const&) {
+    rethrown = true;
+  }
+  assert(rethrown && !sma.is_in_transition() && sma.is_in_state<AsyncTopState::Flushed>());
+
+  assert(boot_machine.is_in_state<LifecycleTopState::Unconfigured>() && !boot_machine.is_started());
+  [[maybe_unused]] bool booted = boot_machine.dispatch<Event<CONFIGURE>>();
+  assert(booted && boot_machine.is_in_state<LifecycleTopState::Inactive>());
+  assert(entry_machine.is_in_state<EntryTopState::Idle>() && !entry_machine.is_started());
+  // the first dispatch starts the machine, entering Idle before the event
+  booted = entry_machine.dispatch<Event<CONFIGURE>>();
+  assert(!booted && entry_machine.is_started() && entry_machine.get_state<EntryTopState>().entries == 1);
+  entry_machine.start();
+  assert(entry_machine.get_state<EntryTopState>().entries == 1);
+
+  StateMachine<DoorTopState> smd;
+  [[maybe_unused]] bool door_reacted = smd.dispatch<Event<ACTIVATE>>();
+  assert(!door_reacted && smd.is_in_state<DoorTopState::Closed>());
+  door_reacted = smd.dispatch<Event<ACTIVATE>>();
+  assert(door_reacted && smd.is_in_state<DoorTopState::Open>());
+  door_reacted = smd.dispatch<Event<DEACTIVATE>>();
+  door_reacted = smd.dispatch<Event<DEACTIVATE>>() && door_reacted;
+  assert(door_reacted);
+  assert(smd.is_in_state<DoorTopState::Locked>() && smd.get_state<DoorTopState>().locks == 1);
+  door_reacted = smd.dispatch<Event<ACTIVATE>>();
+  assert(door_reacted && smd.is_in_state<DoorTopState::Closed>());
+
+  StateMachine<SplitTopState> sm_split;
+  [[maybe_unused]] bool split_reacted = sm_split.dispatch<Event<ACTIVATE>>();
+  assert(split_reacted && sm_split.is_in_state<SplitTopState::Lane::Behind>());
+  assert(!sm_split.is_in_state<SplitTopState::Lane::Ahead>() && sm_split.is_in_state<SplitTopState::Spare::Idle>());
+
+  StateMachine<RowConflictTopState> smrc;
+  [[maybe_unused]] bool row_reacted = smrc.dispatch<Event<ACTIVATE>>();
+  assert(row_reacted && smrc.is_in_state<RowConflictTopState::Running::Left::Down>());
+  assert(smrc.get_state<RowConflictTopState>().actions == 0);
+
+  using Unarbitrated = Arbiter<UnarbitratedConfig>;
+  StateMachine<Unarbitrated> sm_first;
+  sm_first.dispatch<Event<DEACTIVATE>>();
+  assert(sm_first.is_in_state<Unarbitrated::Stopped>() && sm_first.get_state<Unarbitrated>().actions == 1);
+
+  StateMachine<ArbiterOf<InnerFirst>> sm_inner;
+  [[maybe_unused]] bool arbitrated = sm_inner.dispatch<Event<DEACTIVATE>>();
+  assert(arbitrated);
+  assert(sm_inner.is_in_state<ArbiterOf<InnerFirst>::Paused>() && sm_inner.get_state<ArbiterOf<InnerFirst>>().actions == 0);
+  assert(sm_inner.conflict_report().conflicts == 1);
+  assert(sm_inner.conflict_report().rejected == state_combination_v<ArbiterOf<InnerFirst>::Running::Sensor::Watching>);
+  // accepted by transition(), rejected once the reacting states are resolved
+  assert(sm_inner.get_state<ArbiterOf<InnerFirst>>().accepted == 1);
+
+  StateMachine<ArbiterOf<OuterFirst>> sm_outer;
+  sm_outer.dispatch<Event<DEACTIVATE>>();
+  assert(sm_outer.is_in_state<ArbiterOf<OuterFirst>::Stopped>() && sm_outer.get_state<ArbiterOf<OuterFirst>>().actions == 1);
+  assert(sm_outer.conflict_report().rejected == state_combination_v<ArbiterOf<OuterFirst>::Running::Operator::Driving::Manual>);
+
+  {
+    StateMachine<SessionTopState> sm_session;
+    using Typed = Session<SessionConfig<false>>;
+    using Shared = Session<SessionConfig<true>>;
+    auto same = [&] {
+      return same_session_state<SessionClosed>(sm_session) && same_session_state<SessionHandshake>(sm_session)
+          && same_session_state<SessionSlow>(sm_session) && same_session_state<SessionFast>(sm_session)
+          && sm_session.get_state<Typed>().log == sm_session.get_state<Shared>().log
+          && (sm_session.get_state<Typed>().last == state_combination_v<typename Typed::Open>)
+              == (sm_session.get_state<Shared>().last == state_combination_v<typename Shared::Open>);
+    };
+    assert(same() && sm_session.is_in_state<Shared::Closed>());
+    // deep history before Open was ever active, then into Open, nested moves,
+    // a transition to the enclosing state, and back through deep history
+    const LifecycleEvent script[] = {ACTIVATE, CLEANUP, CONFIGURE, ACTIVATE, ACTIVATE, DEACTIVATE, ACTIVATE, ACTIVATE,
+        CLEANUP, ACTIVATE, DEACTIVATE, CLEANUP, CONFIGURE, DEACTIVATE};
+    [[maybe_unused]] bool all_same = true;
+    for (LifecycleEvent event : script) {
+      switch (event) {
+        case CONFIGURE: sm_session.dispatch<Event<CONFIGURE>>(); break;
+        case CLEANUP: sm_session.dispatch<Event<CLEANUP>>(); break;
+        case ACTIVATE: sm_session.dispatch<Event<ACTIVATE>>(); break;
+        case DEACTIVATE: sm_session.dispatch<Event<DEACTIVATE>>(); break;
+      }
+      all_same = same() && all_same;
+    }
+    assert(all_same && sm_session.is_in_state<Shared::Open::Handshake>());
+    assert(sm_session.get_state<Shared>().log != 0);
+  }
+
+  StateMachine<ArbiterOf<RegionPriority>> sm_priority;
+  sm_priority.dispatch<Event<DEACTIVATE>>();
+  assert(sm_priority.is_in_state<ArbiterOf<RegionPriority>::Paused>());
+
+  using Rejecting = ArbiterOf<RejectAll>;
+  StateMachine<Rejecting> sm_reject;
+  sm_reject.dispatch<Event<DEACTIVATE>>();
+  assert(sm_reject.is_in_state<Rejecting::Running>() && sm_reject.get_state<Rejecting>().actions == 0);
+  assert(sm_reject.conflict_report().sources == sm_reject.conflict_report().rejected);
+  assert(sm_reject.conflict_report().rejected == (state_combination_v<Rejecting::Running::Sensor::Watching>
+      | state_combination_v<Rejecting::Running::Operator::Driving::Manual>));
+  sm_reject.dispatch<Event<ACTIVATE>>();
+  assert(sm_reject.conflict_report().conflicts == 0);
+
+  StateMachine<PublishedTopState> sm_published;
+  auto const& published = sm_published.published();
+  assert(published.active_states() == sm_published.active_states());
+  std::atomic<bool> monitoring{true};
+  std::thread monitor([&]{
+    using Top = PublishedTopState;
+    while (monitoring.load()) {
+      [[maybe_unused]] const auto active = published.active_states();
+      assert(!(active & state_combination_v<Top::Idle>) != !(active & state_combination_v<Top::Busy>));
+      [[maybe_unused]] const auto history = published.history<Top::Busy>();
+      assert(!history.last || history.last_recursive & history.last);
+    }
+  });
+  for (int i = 0; i < 1000; i++) {
+    sm_published.dispatch<Event<ACTIVATE>>();
+    sm_published.dispatch<Event<CONFIGURE>>();
+    sm_published.dispatch<Event<DEACTIVATE>>();
+  }
+  monitoring = false;
+  monitor.join();
+  assert(published.is_in_state<PublishedTopState::Idle>());
+  assert(published.history<PublishedTopState::Busy>().last == state_combination_v<PublishedTopState::Busy::Saving>);
+  {
+    // published once, after the batch
+    using PublishedEvents = std::variant<Event<ACTIVATE>, Event<CONFIGURE>, Event<DEACTIVATE>>;
+    const PublishedEvents batch[] = {Event<ACTIVATE>{}, Event<CONFIGURE>{}, Event<DEACTIVATE>{}, Event<ACTIVATE>{}};
+    [[maybe_unused]] const auto epoch = sm_published.epoch();
+    [[maybe_unused]] const std::size_t reacted = sm_published.dispatch_batch(batch);
+    assert(reacted == 4 && sm_published.epoch() == epoch + 4 && published.epoch() == epoch + 4);
+    assert(published.active_states() == sm_published.active_states() && published.is_in_state<PublishedTopState::Busy::Loading>());
+  }
+
+  using Busy = PublishedTopState::Busy;
+  // a transition below an unchanged sub state refreshes the configuration
+  StateMachine<PublishedTopState> sm_nested;
+  sm_nested.dispatch<Event<ACTIVATE>>();
+  sm_nested.dispatch<Event<CONFIGURE>>();
+  assert(sm_nested.is_in_state<Busy::Saving>() && !sm_nested.is_in_state<Busy::Loading>());
+  assert(sm_nested.active_states() == (state_combination_v<PublishedTopState> | state_combination_v<Busy> | state_combination_v<Busy::Saving>));
+
+  SpscChannel<Notification<std::uint64_t>, 8> changes;
+  SpscChannel<Notification<std::uint64_t>, 1> narrow;
+  StateMachine<PublishedTopState> sm_observed;
+  [[maybe_unused]] bool subscribed = sm_observed.subscribe<Busy::Saving, Busy>(changes, 7);
+  assert(subscribed);
+  subscribed = sm_observed.subscribe<Busy, Busy>(narrow);
+  assert(subscribed);
+  [[maybe_unused]] const auto epoch = sm_observed.epoch();
+  sm_observed.dispatch<Event<ACTIVATE>>();
+  assert(changes.empty() && sm_observed.epoch() == epoch + 1);
+  sm_observed.dispatch<Event<CONFIGURE>>();
+  sm_observed.dispatch<Event<CLEANUP>>();
+  sm_observed.dispatch<Event<DEACTIVATE>>();
+  assert(sm_observed.epoch() == epoch + 3 && sm_observed.published().epoch() == epoch + 3);
+  // narrow still holds the entry into Busy, so the exit is dropped
+  assert(sm_observed.dropped_notifications() == 1);
+  std::vector<Notification<std::uint64_t>> received;
+  changes.drain([&](auto const& notification) { received.push_back(notification); });
+  assert(received.size() == 2 && received[0].tag == 7 && received[1].epoch == epoch + 3);
+  assert((received[0].entered & state_combination_v<Busy::Saving>) && (received[1].exited & state_combination_v<Busy>));
+  [[maybe_unused]] bool unsubscribed = sm_observed.unsubscribe(changes);
+  assert(unsubscribed);
+  sm_observed.dispatch<Event<ACTIVATE>>();
+  assert(changes.empty());
+
+  const auto media = describe<MediaTopState, MediaEvents>();
+  MachineDescription decoded;
+  const auto encoded = media.encode();
+  [[maybe_unused]] bool decoded_ok = MachineDescription::decode(encoded.data(), encoded.size(), decoded);
+  assert(decoded_ok && decoded.encode() == encoded);
+  decoded_ok = MachineDescription::decode(encoded.data(), encoded.size() - 1, decoded);
+  assert(!decoded_ok);
+  // invalid descriptions leave the interpreter empty
+  Interpreter empty{MachineDescription{}};
+  [[maybe_unused]] bool interpreted = empty.dispatch(0);
+  assert(!empty && !interpreted && empty.active_states() == 0 && !empty.is_in_state(0));
+  MachineDescription orphan = media;
+  orphan.states[1].parent = 5;
+  Interpreter inconsistent{orphan};
+  interpreted = inconsistent.dispatch(0);
+  assert(!inconsistent && !interpreted && inconsistent.last_recursive(0) == 0);
+  struct MediaHandlers
+  {
+    bool loud_allowed = false;
+    int quietened = 0;
+  } media_handlers;
+  Interpreter interpreter{decoded, {&media_handlers,
+    [](void* context, std::uint16_t, const void*) { return static_cast<MediaHandlers*>(context)->loud_allowed; },
+    [](void* context, std::uint16_t, const void*) { static_cast<MediaHandlers*>(context)->quietened++; }}};
+  assert(interpreter);
+  StateMachine<MediaTopState> sm_media;
+  const MediaEvent script[] = {PLAY, POWER, VOLUME, PLAY, SPEED, POWER, POWER, STOP, VOLUME, PLAY, SPEED, SPEED, POWER, POWER, VOLUME, VOLUME};
+  for (MediaEvent event : script) {
+    if (event == STOP) {
+      sm_media.get_state<MediaTopState>().loud_allowed = media_handlers.loud_allowed = true;
+    }
+    [[maybe_unused]] bool reacted = false;
+    switch (event) {
+      case POWER: reacted = sm_media.dispatch<Event<POWER>>(); break;
+      case PLAY: reacted = sm_media.dispatch<Event<PLAY>>(); break;
+      case STOP: reacted = sm_media.dispatch<Event<STOP>>(); break;
+      case SPEED: reacted = sm_media.dispatch<Event<SPEED>>(); break;
+      case VOLUME: reacted = sm_media.dispatch<Event<VOLUME>>(); break;
+    }
+    interpreted = interpreter.dispatch(event);
+    assert(interpreted == reacted && interpreter.active_states() == sm_media.active_states());
+  }
+  assert(interpreter.last_recursive(state_id_v<MediaTopState::On>) == sm_media.get_state<MediaTopState::On>().last_recursive);
+  assert(sm_media.is_in_state<MediaTopState::On::Media::Playing::Normal>() && sm_media.is_in_state<MediaTopState::On::Volume::Loud>());
+  assert(sm_media.get_state<MediaTopState>().quietened == 1 && media_handlers.quietened == 1);
+
+  // no partitions at all runs as one
+  for (std::size_t partitions : {0, 1, 2}) {
+    Simulation<TickerTopState> simulation{3, partitions};
+    std::vector<StateMachine<TickerTopState>> tickers(4);
+    for (std::uint32_t i = 0; i < 4; i++) {
+      simulation.schedule(i, i, Event<ACTIVATE>{});
+    }
+    auto resolve = [&](std::uint32_t i) -> auto& { return tickers[i]; };
+    [[maybe_unused]] const std::size_t events = partitions == 1 ? simulation.run(1000, resolve) : simulation.run_parallel(1000, resolve);
+    assert(events == 4 * 5 + 4 * 4 && simulation.pending() == 0 && simulation.time() == 1000);
+    for (std::uint32_t i = 0; i < 4; i++) {
+      [[maybe_unused]] auto& top = tickers[i].get_state<TickerTopState>();
+      assert(tickers[i].is_in_state<TickerTopState::Stopped>());
+      assert(top.ticks == 5 && top.pings == 4 && top.last_tick == 40 + i);
+    }
+  }
+
+  static_assert(queue_policy_v<Event<ACTIVATE>> == QueuePolicy::fifo);
+  static_assert(handler_mask_v<SensorTopState, Poke> == state_combination_v<SensorTopState::Armed>);
+  static_assert(handler_mask_v<SensorTopState, Status> == state_combination_v<SensorTopState>);
+  static_assert(!std::is_default_constructible_v<Status> && !std::is_default_constructible_v<Reading>);
+  {
+    Inbox<SensorTopState, 4> inbox;
+    StateMachine<SensorTopState> sensor;
+    [[maybe_unused]] bool pushed = true;
+    for (int i = 1; i <= 3; i++) {
+      pushed = inbox.push(Status{i}) && pushed;
+    }
+    for (int i = 1; i <= 6; i++) {
+      pushed = inbox.push(Reading{i}) && pushed;
+    }
+    pushed = inbox.push(Poke{}) && pushed;
+    pushed = inbox.push(Event<ACTIVATE>{}) && pushed;
+    pushed = inbox.push(Poke{}) && pushed;
+    pushed = inbox.push(Event<ACTIVATE>{}) && pushed;
+    assert(pushed);
+    pushed = inbox.push(Event<ACTIVATE>{});
+    assert(!pushed);
+    // Poke dropped while Idle, Poke handled once Armed
+    [[maybe_unused]] std::size_t handled = inbox.drain(sensor);
+    assert(handled == 3 + 4 + 1);
+    auto& top = sensor.get_state<SensorTopState>();
+    assert(top.pokes == 1);
+    assert((top.samples == std::vector<int>{3, 4, 5, 6}));
+    assert((top.statuses == std::vector<int>{3}));
+    assert(inbox.shed<Status>() == 2 && inbox.shed<Reading>() == 2 && inbox.shed<Poke>() == 1);
+    assert(inbox.shed<Event<ACTIVATE>>() == 0 && inbox.rejected() == 1);
+    handled = inbox.drain(sensor);
+    assert(handled == 0);
+
+    // a producer thread floods statuses and samples while this one drains
+    constexpr int count = 100000;
+    std::thread producer([&] {
+      for (int i = 1; i <= count; i++) {
+        inbox.push(Reading{i});
+        inbox.push(Status{i});
+      }
+    });
+    top.statuses.clear();
+    top.samples.clear();
+    while (top.statuses.empty() || top.statuses.back() != count) {
+      inbox.drain(sensor);
+    }
+    producer.join();
+    inbox.drain(sensor);
+    assert(std::is_sorted(top.statuses.begin(), top.statuses.end()));
+    assert(std::is_sorted(top.samples.begin(), top.samples.end()) && top.samples.back() == count);
+    assert(top.statuses.size() + inbox.shed<Status>() == count + 2);
+    assert(top.samples.size() + inbox.shed<Reading>() == count + 2);
+  }
+
+  {
+    StateMachine<PrunedTopState> pruned;
+    for (auto name : pruned_state_names<PrunedTopState>) {
+      std::cout << "pruned: " << name << std::endl;
+    }
+    pruned.dispatch<Event<ACTIVATE>>();
+    pruned.dispatch<Event<CONFIGURE>>();
+    assert(pruned.is_in_state<PrunedTopState::Running::Fast>());
+    pruned.dispatch<Event<DEACTIVATE>>();
+    assert(pruned.is_in_state<PrunedTopState::Stopped>() && pruned.active_states() == 0b1001);
+  }
+
+#if defined(__linux__)
+  {
+    // the region in a memory file, read back through a read-only mapping
+    using Region = ResidentRegion<ResidentTopState>;
+    using Top = ResidentTopState;
+    const std::size_t size = Region::size(3);
+    const int fd = memfd_create("resident", 0);
+    [[maybe_unused]] const int sized = ftruncate(fd, size);
+    assert(fd >= 0 && sized == 0);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(memory != MAP_FAILED && view != MAP_FAILED);
+    assert(!ResidentReader(view, size));
+    Region region{memory, 3};
+    StateMachine<Top> machines[2];
+    machines[0].attach(region.slot(0));
+    machines[1].attach(region.slot(1));
+
+    ResidentReader reader{view, size};
+    assert(reader && reader.machine_count() == 3 && reader.state_count() == 5 && reader.data_size() == sizeof(Top::Counters));
+    assert(!ResidentReader(view, size - 1));
+    for (std::size_t id = 0; id < reader.state_count(); id++) {
+      assert(reader.state_name(id) == state_names<Top>[id]);
+    }
+    std::atomic<bool> inspecting{true};
+    std::thread inspector([&] {
+      ResidentSnapshot snapshot;
+      while (inspecting.load()) {
+        [[maybe_unused]] const ResidentStatus read_status = reader.read(0, snapshot);
+        assert(read_status == ResidentStatus::ok);
+        assert(!(snapshot.active & state_combination_v<Top::Idle>) != !(snapshot.active & state_combination_v<Top::Busy>));
+      }
+    });
+    for (int i = 0; i < 1000; i++) {
+      machines[0].dispatch<Event<ACTIVATE>>();
+      machines[0].dispatch<Event<CONFIGURE>>();
+      machines[0].dispatch<Event<DEACTIVATE>>();
+    }
+    inspecting = false;
+    inspector.join();
+    machines[1].dispatch<Event<ACTIVATE>>();
+    machines[1].dispatch<Event<CLEANUP>>();
+
+    ResidentSnapshot snapshot;
+    [[maybe_unused]] ResidentStatus read_status = reader.read(0, snapshot);
+    assert(read_status == ResidentStatus::ok && snapshot.epoch == machines[0].epoch() && snapshot.active == machines[0].active_states());
+    assert(snapshot.last[state_id_v<Top::Busy>] == state_combination_v<Top::Busy::Saving>);
+    read_status = reader.read(1, snapshot);
+    assert(read_status == ResidentStatus::ok && snapshot.active & state_combination_v<Top::Busy::Loading>);
+    assert(snapshot.last_recursive[state_id_v<Top>] == machines[1].active_states());
+    Top::Counters counters;
+    std::memcpy(&counters, snapshot.data.data(), sizeof(counters));
+    assert(counters.activations == 1 && counters.cleanups == 1);
+    read_status = reader.read(2, snapshot);
+    assert(read_status == ResidentStatus::unwritten);
+    read_status = reader.read(3, snapshot);
+    assert(read_status == ResidentStatus::out_of_range);
+    // a writer that died mid-change leaves the sequence odd
+    auto* sequence = static_cast<std::atomic<std::uint64_t>*>(static_cast<void*>(static_cast<std::byte*>(memory)
+        + Region::slots_offset + 2 * Region::slot_size));
+    sequence->store(1);
+    read_status = reader.read(2, snapshot, 100);
+    assert(read_status == ResidentStatus::torn);
+    munmap(memory, size);
+    munmap(const_cast<void*>(view), size);
+  }
+
+  test_sharding<UnixSocket>("socket", [] {
+    auto ends = UnixSocket::pair();
+    return std::pair{std::move(ends[0]), std::move(ends[1])};
+  });
+  test_sharding<SharedRing>("shared ring", [] {
+    // two mappings of one file, one for each side
+    constexpr std::size_t capacity = 1024;
+    const int fd = memfd_create("shard", 0);
+    [[maybe_unused]] const int sized = ftruncate(fd, SharedRing::region_size(capacity));
+    assert(fd >= 0 && sized == 0);
+    std::pair ends{SharedRing{fd, capacity}, SharedRing{fd, capacity}};
+    close(fd);
+    return ends;
+  });
+
+  // a side waiting on the ring gives up once the other process exits
+  for (bool reader_exits : {false, true}) {
+    SharedRing ring{64};
+    std::byte bytes[128]{};
+    std::cout.flush();
+    const pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      const bool done = reader_exits ? ring.read(bytes, 1) : ring.write(bytes, 1);
+      _exit(done ? 0 : 1);
+    }
+    [[maybe_unused]] const bool completed = reader_exits ? ring.write(bytes, sizeof(bytes)) : ring.read(bytes, 2);
+    assert(!completed);
+    int status;
+    [[maybe_unused]] const pid_t exited = waitpid(pid, &status, 0);
+    assert(exited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+#endif
+
+#if defined(__cpp_impl_coroutine)
+  StateMachine<ProtocolTopState> smp;
+  [[maybe_unused]] bool awaited = smp.dispatch(Timeout{});
+  assert(!awaited);
+  awaited = smp.dispatch(Ack{1});
+  awaited = smp.dispatch(Ack{2}) && awaited;
+  assert(awaited);
+  assert(smp.is_in_state<ProtocolTopState::Established>());
+  smp.dispatch<Event<DEACTIVATE>>();
+  smp.dispatch(Ack{3});
+  smp.dispatch(Timeout{});
+  assert(smp.is_in_state<ProtocolTopState::Failed>());
+  assert((smp.get_state<ProtocolTopState>().log == std::vector<int>{0, 1, 2, 0, 3}));
+#endif
  /*static_assert(!std::is_void_v<TLC<TLCConfig2>::Conf::TopState>);
   ass<typename SimpleStateWrapper<TLC<TLCConfig2>::Unconfigured>::TopState, TLC2TopState>();
 
@@ -14,9 +14,19 @@
 
 #pragma once
 
+// Tracing of events, reactions, entries and exits to std::cout. Define
+// METAHSM_TRACE=0 to compile it out, together with the <iostream> dependency.
+#ifndef METAHSM_TRACE
+#define METAHSM_TRACE 1
+#endif
+
 #include <tuple>
-#include <string>
+#include <array>
+#include <string_view>
+#include <cstdint>
+#if METAHSM_TRACE
 #include <iostream>
+#endif
 
 #include "type_traits.hpp"
 
@@ -32,27 +42,34 @@ constexpr auto get_type_name(){
 }
 
 template <typename _TopStateDef>
-const std::array<std::string_view, std::tuple_size_v<all_states_t<_TopStateDef>>> state_names = std::apply([](auto ... state) {
+inline constexpr std::array<std::string_view, std::tuple_size_v<all_states_t<_TopStateDef>>> state_names = std::apply([](auto ... state) {
     return std::array{get_type_name<typename decltype(state)::type>()...};
 }, tuple_apply_t<type_identity, all_states_t<_TopStateDef>>{});
 
-template <typename Event_>
-void trace_event() {
-    std::cout << get_type_name<Event_>() << std::endl;
+// Names of the states removed by reachability pruning (see pruned_states_t).
+template <typename _TopStateDef>
+inline constexpr std::array<std::string_view, std::tuple_size_v<pruned_states_t<_TopStateDef>>> pruned_state_names = std::apply([](auto ... state) {
+    return std::array<std::string_view, sizeof...(state)>{get_type_name<typename decltype(state)::type>()...};
+}, tuple_apply_t<type_identity, pruned_states_t<_TopStateDef>>{});
+
+#if METAHSM_TRACE
+
+// The templates below only look up names; the printing itself is shared by all
+// states and machines.
+inline void trace_event(std::string_view event) {
+    std::cout << event << std::endl;
 }
 
-template <typename State_>
-void trace_react(bool result, state_combination_t<top_state_t<State_>> & target) {
-    std::string did_react = result ? "true" : "false";
-    std::cout << "   " << get_type_name<State_>() << "::react: "  << did_react;
+inline void trace_react(std::string_view state, bool result, std::uint64_t target, std::string_view const* names, std::size_t count) {
+    std::cout << "   " << state << "::react: "  << (result ? "true" : "false");
     if(target) {
         std::cout << ", target: {";
         bool first = true;
-        for(std::size_t state_id = 0; state_id < std::tuple_size_v<all_states_t<top_state_t<State_>>>; state_id++) {
-            if(target & (std::size_t{1} << state_id)) {
+        for(std::size_t state_id = 0; state_id < count; state_id++) {
+            if(target & (std::uint64_t{1} << state_id)) {
                 if (first) { first = false; }
                 else { std::cout << ","; }
-                std::cout << state_names<top_state_t<State_>>.at(state_id);
+                std::cout << names[state_id];
             }
         }
         std::cout << "}";
@@ -63,16 +80,49 @@ void trace_react(bool result, state_combination_t<top_state_t<State_>> & target)
     std::cout << std::endl;
 }
 
+inline void trace_enter(std::string_view state) {
+    std::cout << "   " << state << "::enter"  << std::endl;
+}
+
+inline void trace_exit(std::string_view state) {
+    std::cout << "   " << state << "::exit"  << std::endl;
+}
+
+template <typename Event_>
+void trace_event() {
+    trace_event(get_type_name<Event_>());
+}
+
+template <typename State_>
+void trace_react(bool result, state_combination_t<top_state_t<State_>> & target) {
+    auto& names = state_names<top_state_t<State_>>;
+    trace_react(get_type_name<State_>(), result, target, names.data(), names.size());
+}
+
 template <typename _StateDef>
 void trace_enter() {
-    std::cout << "   " << get_type_name<_StateDef>() << "::enter"  << std::endl;
+    trace_enter(get_type_name<_StateDef>());
 }
 
 template <typename _StateDef>
 void trace_exit() {
-    std::cout << "   " << get_type_name<_StateDef>() << "::exit"  << std::endl;
+    trace_exit(get_type_name<_StateDef>());
 }
 
+#else
+
+template <typename Event_>
+void trace_event() {}
+
+template <typename State_>
+void trace_react(bool, state_combination_t<top_state_t<State_>> &) {}
+
+template <typename _StateDef>
+void trace_enter() {}
+
+template <typename _StateDef>
+void trace_exit() {}
 
+#endif
 
 }
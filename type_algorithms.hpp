@@ -14,8 +14,10 @@
 
 #pragma once
 
+#include <cstddef>
 #include <tuple>
 #include <variant>
+#include <utility>
 
 namespace metahsm {
 
@@ -53,8 +55,28 @@ struct as_tuple<std::tuple<_T...>> { using type = std::tuple<_T...>; };
 template <typename _T>
 using as_tuple_t = typename as_tuple<_T>::type;
 
+template <typename ... _Tuple>
+struct tuple_join;
+
+template <>
+struct tuple_join<> { using type = std::tuple<>; };
+
+template <typename ... _T>
+struct tuple_join<std::tuple<_T...>> { using type = std::tuple<_T...>; };
+
+template <typename ... _T1, typename ... _T2>
+struct tuple_join<std::tuple<_T1...>, std::tuple<_T2...>> { using type = std::tuple<_T1..., _T2...>; };
+
+template <typename ... _T1, typename ... _T2, typename ... _T3, typename ... _T4, typename ... _Rest>
+struct tuple_join<std::tuple<_T1...>, std::tuple<_T2...>, std::tuple<_T3...>, std::tuple<_T4...>, _Rest...>
+    : tuple_join<std::tuple<_T1..., _T2..., _T3..., _T4...>, _Rest...> {};
+
+template <typename ... _T1, typename ... _T2, typename _Tuple3, typename ... _Rest>
+struct tuple_join<std::tuple<_T1...>, std::tuple<_T2...>, _Tuple3, _Rest...>
+    : tuple_join<std::tuple<_T1..., _T2...>, _Tuple3, _Rest...> {};
+
 template <typename ... _T>
-using tuple_join_t = decltype(std::tuple_cat(std::declval<as_tuple_t<_T>>()...));
+using tuple_join_t = typename tuple_join<as_tuple_t<_T>...>::type;
 
 template <typename _T>
 struct to_variant;
@@ -68,22 +90,37 @@ struct to_variant<std::tuple<_T...>>
 template <typename _T>
 using to_variant_t = typename to_variant<_T>::type;
 
-template <typename _T, typename _Tuple>
-struct index;
+// Index map of a tuple: one base per element, so that looking up an index is a
+// single overload resolution instead of a recursion over the tuple.
+template <typename _T, std::size_t _I>
+struct indexed {};
 
-template <typename _T, typename ... _Us>
-struct index<_T, std::tuple<_T, _Us...>> {
-    static constexpr std::size_t value = 0;
-};
+template <typename _Tuple, typename _Indices = std::make_index_sequence<std::tuple_size_v<_Tuple>>>
+struct index_map;
+
+template <typename ... _T, std::size_t ... _I>
+struct index_map<std::tuple<_T...>, std::index_sequence<_I...>> : indexed<_T, _I>... {};
+
+template <typename _T, std::size_t _I>
+constexpr std::size_t index_of(indexed<_T, _I> const*) { return _I; }
 
-template <typename _T, typename _U, typename ... _Us>
-struct index<_T, std::tuple<_U, _Us...>> {
-    static constexpr std::size_t value = 1 + index<_T, std::tuple<_Us...>>::value;
+template <typename _T, typename _Tuple>
+struct index {
+    static constexpr std::size_t value = index_of<_T>(static_cast<index_map<_Tuple>*>(nullptr));
 };
 
 template <typename _T, typename _Tuple>
 constexpr std::size_t index_v = index<_T, _Tuple>::value;
 
+template <typename _T, typename _Tuple>
+struct tuple_contains;
+
+template <typename _T, typename ... _Elem>
+struct tuple_contains<_T, std::tuple<_Elem...>> : std::bool_constant<(std::is_same_v<_T, _Elem> || ...)> {};
+
+template <typename _T, typename _Tuple>
+constexpr bool tuple_contains_v = tuple_contains<_T, _Tuple>::value;
+
 template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
 template<class... Ts> overload(Ts...) -> overload<Ts...>;
 
@@ -105,17 +142,10 @@ struct tuple_strip_void;
 template <typename _Tuple>
 using tuple_strip_void_t = typename tuple_strip_void<_Tuple>::type;
 
-template <typename _T1, typename ... _T>
-struct tuple_strip_void<std::tuple<_T1, _T...>>
-{
-    using rest = tuple_strip_void_t<std::tuple<_T...>>;
-    using type = std::conditional_t<std::is_same_v<_T1, void>, rest, tuple_join_t<_T1, rest>>;
-};
-
-template <>
-struct tuple_strip_void<std::tuple<>>
+template <typename ... _T>
+struct tuple_strip_void<std::tuple<_T...>>
 {
-    using type = std::tuple<>;
+    using type = typename tuple_join<std::conditional_t<std::is_same_v<_T, void>, std::tuple<>, std::tuple<_T>>...>::type;
 };
 
 template <template <typename> typename _F, typename _Tuple>
@@ -130,7 +160,7 @@ struct tuple_filter<_F, std::tuple<_T...>>
 template <template <typename> typename _F, typename _Tuple>
 using tuple_filter_t = typename tuple_filter<_F, _Tuple>::type;
 
-std::size_t bit_index(std::size_t x) {
+constexpr std::size_t bit_index(std::size_t x) {
     std::size_t n = 64;
     if ( (x>>32) != 0 ) { n=n-32; x = x>>32; } 
     if ( (x>>16) != 0 ) { n=n-16; x = x>>16; } 
@@ -16,8 +16,8 @@
 #include <type_traits>
 #include <tuple>
 #include <variant>
-#include <iostream>
-#include <bitset>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 
 #include "type_algorithms.hpp"
@@ -31,6 +31,7 @@ struct CompositeStateBase : StateBase {};
 struct OrthogonalStateBase : StateBase {};
 struct TopStateBase {};
 struct RootState : StateBase {};
+struct HistoryBase;
 class StateImplBase;
 
 template <typename _Entity, typename _SFINAE = void>
@@ -60,6 +61,173 @@ struct has_initial<_Entity, std::void_t<std::tuple<typename _Entity::Initial>>>
 template <typename _Entity>
 constexpr bool has_initial_v = has_initial<_Entity>::value;
 
+template <typename _Entity, typename _SFINAE = void>
+struct max_completion_steps : std::integral_constant<std::size_t, 8> {};
+
+template <typename _Entity>
+struct max_completion_steps<_Entity, std::void_t<decltype(_Entity::max_completion_steps)>>
+    : std::integral_constant<std::size_t, _Entity::max_completion_steps> {};
+
+template <typename _Entity>
+constexpr std::size_t max_completion_steps_v = max_completion_steps<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct max_deferred_events : std::integral_constant<std::size_t, 0> {};
+
+template <typename _Entity>
+struct max_deferred_events<_Entity, std::void_t<decltype(_Entity::max_deferred_events)>>
+    : std::integral_constant<std::size_t, _Entity::max_deferred_events> {};
+
+template <typename _Entity>
+constexpr std::size_t max_deferred_events_v = max_deferred_events<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct max_subscribers : std::integral_constant<std::size_t, 0> {};
+
+template <typename _Entity>
+struct max_subscribers<_Entity, std::void_t<decltype(_Entity::max_subscribers)>>
+    : std::integral_constant<std::size_t, _Entity::max_subscribers> {};
+
+template <typename _Entity>
+constexpr std::size_t max_subscribers_v = max_subscribers<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct publishes_configuration : std::false_type {};
+
+template <typename _Entity>
+struct publishes_configuration<_Entity, std::void_t<decltype(_Entity::publish_configuration)>>
+    : std::bool_constant<_Entity::publish_configuration> {};
+
+template <typename _Entity>
+constexpr bool publishes_configuration_v = publishes_configuration<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct shared_body : std::false_type {};
+
+template <typename _Entity>
+struct shared_body<_Entity, std::void_t<decltype(_Entity::shared_body)>>
+    : std::bool_constant<_Entity::shared_body> {};
+
+// Composite states declaring `static constexpr bool shared_body = true;` run
+// their sub-machine on the shared engine (see SharedCompositeWrapper).
+template <typename _Entity>
+constexpr bool shared_body_v = shared_body<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct resident_configuration : std::false_type {};
+
+template <typename _Entity>
+struct resident_configuration<_Entity, std::void_t<decltype(_Entity::resident_configuration)>>
+    : std::bool_constant<_Entity::resident_configuration> {};
+
+template <typename _Entity>
+constexpr bool resident_configuration_v = resident_configuration<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct resident_data { using type = void; };
+
+template <typename _Entity>
+struct resident_data<_Entity, std::void_t<typename _Entity::ResidentData>> { using type = typename _Entity::ResidentData; };
+
+template <typename _Entity>
+using resident_data_t = typename resident_data<_Entity>::type;
+
+// How an inbound queue (see inbox.hpp) treats an event type, declared on the
+// event as `static constexpr QueuePolicy queue_policy = ...`.
+enum class QueuePolicy
+{
+  fifo,            // queued in order, rejected when the queue is full
+  coalesce_latest, // only the latest value is kept until the next drain
+  drop_unhandled,  // queued in order, dropped at drain if no active state reacts
+  drop_oldest      // never rejected: a full queue sheds its oldest entry
+};
+
+template <typename _Entity, typename _SFINAE = void>
+struct queue_policy : std::integral_constant<QueuePolicy, QueuePolicy::fifo> {};
+
+template <typename _Entity>
+struct queue_policy<_Entity, std::void_t<decltype(_Entity::queue_policy)>>
+    : std::integral_constant<QueuePolicy, _Entity::queue_policy> {};
+
+template <typename _Entity>
+constexpr QueuePolicy queue_policy_v = queue_policy<_Entity>::value;
+
+// Declarative transitions of a machine, declared on its top state as
+// `using Transitions = std::tuple<Transition<...>, ...>`.
+template <typename _Entity, typename _SFINAE = void>
+struct transitions { using type = std::tuple<>; };
+
+template <typename _Entity>
+struct transitions<_Entity, std::void_t<typename _Entity::Transitions>> { using type = typename _Entity::Transitions; };
+
+template <typename _Entity>
+using transitions_t = typename transitions<_Entity>::type;
+
+// Storage layout hints, declared on the top state as `using HotStates = ...`
+// and `using ColdStates = ...` (tuples of states). A profile of the states
+// entered most often can be fed back as HotStates.
+template <typename _Entity, typename _SFINAE = void>
+struct hot_states { using type = std::tuple<>; };
+
+template <typename _Entity>
+struct hot_states<_Entity, std::void_t<typename _Entity::HotStates>> { using type = typename _Entity::HotStates; };
+
+template <typename _Entity>
+using hot_states_t = typename hot_states<_Entity>::type;
+
+template <typename _Entity, typename _SFINAE = void>
+struct cold_states { using type = std::tuple<>; };
+
+template <typename _Entity>
+struct cold_states<_Entity, std::void_t<typename _Entity::ColdStates>> { using type = typename _Entity::ColdStates; };
+
+template <typename _Entity>
+using cold_states_t = typename cold_states<_Entity>::type;
+
+// Reachability pruning, enabled by `static constexpr bool prune_unreachable = true;`
+// on the top state. Transitions made by react() are invisible to the analysis,
+// so each state declares the states its react() may target as
+// `using Targets = std::tuple<...>` (a state or a History).
+template <typename _Entity, typename _SFINAE = void>
+struct prunes_unreachable : std::false_type {};
+
+template <typename _Entity>
+struct prunes_unreachable<_Entity, std::void_t<decltype(_Entity::prune_unreachable)>>
+    : std::bool_constant<_Entity::prune_unreachable> {};
+
+template <typename _Entity>
+constexpr bool prunes_unreachable_v = prunes_unreachable<_Entity>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct targets { using type = std::tuple<>; };
+
+template <typename _Entity>
+struct targets<_Entity, std::void_t<typename _Entity::Targets>> { using type = typename _Entity::Targets; };
+
+template <typename _Entity>
+using targets_t = typename targets<_Entity>::type;
+
+// Resolution of conflicting transitions (see metahsm.hpp), declared on the top
+// state as `using ConflictPolicy = ...`. void keeps the first valid transition
+// without any bookkeeping.
+template <typename _Entity, typename _SFINAE = void>
+struct conflict_policy { using type = void; };
+
+template <typename _Entity>
+struct conflict_policy<_Entity, std::void_t<typename _Entity::ConflictPolicy>> { using type = typename _Entity::ConflictPolicy; };
+
+template <typename _Entity>
+using conflict_policy_t = typename conflict_policy<_Entity>::type;
+
+template <typename _Entity, typename _SFINAE = void>
+struct region_priority : std::integral_constant<int, 0> {};
+
+template <typename _Entity>
+struct region_priority<_Entity, std::void_t<decltype(_Entity::priority)>> : std::integral_constant<int, _Entity::priority> {};
+
+template <typename _Entity>
+constexpr int region_priority_v = region_priority<_Entity>::value;
+
 template <bool has_substates, bool has_regions>
 struct base;
 
@@ -103,10 +271,14 @@ struct contained_states<State_, SimpleStateBase>
     using all = std::tuple<>;
 };
 
+// SubStates of State_ left after pruning (see prunes_unreachable).
+template <typename State_, typename _SFINAE = void>
+struct live_sub_states;
+
 template <typename State_>
 struct contained_states<State_, CompositeStateBase>
 {
-    using direct = typename State_::SubStates;
+    using direct = typename live_sub_states<State_>::type;
     using all = tuple_join_t<direct, typename contained_states<direct>::all>;
 };
 
@@ -176,6 +348,11 @@ constexpr auto state_combination(type_identity<State_>)
     return value;
 };
 
+constexpr uint64_t state_combination(type_identity<std::tuple<>>)
+{
+    return 0;
+}
+
 template <typename State1_, typename ... State_>
 constexpr auto state_combination(type_identity<std::tuple<State1_, State_...>>)
 {
@@ -193,53 +370,99 @@ constexpr auto state_combination_recursive_v = state_combination(type_identity<a
 template <typename State_>
 constexpr auto state_combination_v = state_combination(type_identity<State_>{});
 
-template <typename State1_, typename StateTuple_>
-struct any;
+// State_ and the states it contains in depth-first pre-order, so that every
+// state is followed by its first child.
+template <typename State_>
+struct depth_first_states
+{
+    using type = tuple_join_t<State_, typename depth_first_states<contained_states_direct_t<State_>>::type>;
+};
 
-template <typename State1_, typename ... State_>
-struct any<State1_, std::tuple<State_...>>
+template <typename ... State_>
+struct depth_first_states<std::tuple<State_...>>
+{
+    using type = tuple_join_t<typename depth_first_states<State_>::type...>;
+};
+
+template <typename State_>
+using depth_first_states_t = typename depth_first_states<State_>::type;
+
+template <typename TopState_>
+struct unhinted_state
 {
-    static constexpr bool value = ((state_id_v<State1_> == state_id_v<State_>) || ...);
+    template <typename State_>
+    using test = std::bool_constant<!tuple_contains_v<State_, hot_states_t<TopState_>>
+        && !tuple_contains_v<State_, cold_states_t<TopState_>>>;
 };
 
-template <typename State_, typename SuperState_, typename OtherStates_>
-struct super_state_impl;
+// Order of the state storage of a machine: HotStates first, then the other
+// states depth-first, so the states of an active path share cache lines.
+// ColdStates are stored apart, after everything else.
+template <typename TopState_>
+using storage_order_t = tuple_join_t<hot_states_t<TopState_>,
+    tuple_filter_t<unhinted_state<TopState_>::template test, depth_first_states_t<TopState_>>>;
+
+// Parent table of a machine: one parent_entry<Child, Parent> base per contained
+// state, built in a single pass over all_states_t. Looking up the parent of a
+// state is then a single overload resolution.
+template <typename Child_, typename Parent_>
+struct parent_entry {};
 
-template <typename State_, typename OtherStates_>
-struct super_state;
+template <typename State_, typename Children_ = contained_states_direct_t<State_>>
+struct parent_entries;
 
-template <typename State_, typename SuperState_, typename ... OtherState_>
-struct super_state_impl<State_, std::tuple<SuperState_>, std::tuple<OtherState_...>>
+template <typename State_, typename ... Child_>
+struct parent_entries<State_, std::tuple<Child_...>>
 {
-    using direct = SuperState_;
-    using recursive = tuple_join_t<direct, typename super_state<direct, std::tuple<OtherState_...>>::recursive>;
+    using type = std::tuple<parent_entry<Child_, State_>...>;
 };
 
-template <typename State_, typename ... OtherState_>
-struct super_state_impl<State_, std::tuple<>, std::tuple<OtherState_...>>
+template <typename Entries_>
+struct parent_map;
+
+template <typename ... Entry_>
+struct parent_map<std::tuple<Entry_...>> : Entry_... {};
+
+template <typename States_>
+struct parent_map_of;
+
+template <typename ... State_>
+struct parent_map_of<std::tuple<State_...>>
 {
-    using direct = void;
-    using recursive = std::tuple<>;
+    using type = parent_map<tuple_join_t<typename parent_entries<State_>::type...>>;
 };
 
-template <typename State_, typename ... OtherState_>
-struct super_state<State_, std::tuple<OtherState_...>>
+template <typename TopState_>
+using parent_map_t = typename parent_map_of<all_states_t<TopState_>>::type;
+
+template <typename Child_, typename Parent_>
+type_identity<Parent_> parent_of(parent_entry<Child_, Parent_> const*);
+
+template <typename Child_>
+type_identity<void> parent_of(...);
+
+template <typename State_>
+using parent_t = typename decltype(parent_of<State_>(static_cast<parent_map_t<top_state_t<State_>>*>(nullptr)))::type;
+
+template <typename State_, typename SuperState_ = parent_t<State_>>
+struct super_state
 {
-    using impl = super_state_impl<State_, tuple_strip_void_t<std::tuple<
-        std::conditional_t<
-           any<State_, contained_states_direct_t<OtherState_>>::value,
-            OtherState_,
-            void>...
-        >>, std::tuple<OtherState_...>>;
-    using direct = typename impl::direct;
-    using recursive = typename impl::recursive;
+    using direct = SuperState_;
+    using recursive = tuple_join_t<direct, typename super_state<direct>::recursive>;
+};
+
+template <typename State_>
+struct super_state<State_, void>
+{
+    using direct = void;
+    using recursive = std::tuple<>;
 };
 
 template <typename State_>
-using super_state_direct_t  = typename super_state<State_, all_states_t<top_state_t<State_>>>::direct;
+using super_state_direct_t  = typename super_state<State_>::direct;
 
 template <typename State_>
-using super_state_recursive_t  = typename super_state<State_, all_states_t<top_state_t<State_>>>::recursive;
+using super_state_recursive_t  = typename super_state<State_>::recursive;
 
 template <typename State_, typename StateBase_ = base_t<State_>>
 struct default_initial_state;
@@ -280,6 +503,196 @@ struct default_initial_state<State_, OrthogonalStateBase>
 template <typename State_>
 using initial_state_t = typename initial_state<State_>::type;
 
+// State targeted by a transition to Target_, which is a state or a History.
+template <typename Target_, bool is_history_ = std::is_base_of_v<HistoryBase, Target_>>
+struct target_state { using type = Target_; };
+
+template <typename Target_>
+struct target_state<Target_, true> { using type = typename Target_::State; };
+
+template <typename Target_>
+using target_state_t = typename target_state<Target_>::type;
+
+// Reachability analysis over the declared hierarchy, before pruning. A state
+// is reachable if it is the top state, the initial state or a region of a
+// reachable state, a target of a reachable state (its Targets or its rows in
+// the Transitions table), or an ancestor of a reachable state.
+template <typename State_, typename StateBase_ = base_t<State_>>
+struct declared_children { using type = std::tuple<>; };
+
+template <typename State_>
+struct declared_children<State_, CompositeStateBase> { using type = typename State_::SubStates; };
+
+template <typename State_>
+struct declared_children<State_, OrthogonalStateBase> { using type = typename State_::Regions; };
+
+template <typename State_>
+struct declared_states
+{
+    using type = tuple_join_t<State_, typename declared_states<typename declared_children<State_>::type>::type>;
+};
+
+template <typename ... State_>
+struct declared_states<std::tuple<State_...>>
+{
+    using type = tuple_join_t<typename declared_states<State_>::type...>;
+};
+
+template <typename TopState_>
+using declared_states_t = typename declared_states<TopState_>::type;
+
+template <typename State_, typename StateBase_ = base_t<State_>>
+struct entered_with { using type = std::tuple<>; };
+
+template <typename State_>
+struct entered_with<State_, CompositeStateBase> { using type = std::tuple<initial_state_t<State_>>; };
+
+template <typename State_>
+struct entered_with<State_, OrthogonalStateBase> { using type = typename State_::Regions; };
+
+template <typename State_>
+struct row_from
+{
+    template <typename Row_>
+    using test = std::is_same<typename Row_::From, State_>;
+};
+
+template <typename Rows_>
+struct row_targets;
+
+template <typename ... Row_>
+struct row_targets<std::tuple<Row_...>> { using type = std::tuple<target_state_t<typename Row_::To>...>; };
+
+template <typename TopState_, typename State_>
+using reach_edges_t = tuple_join_t<typename entered_with<State_>::type,
+    tuple_apply_t<target_state_t, targets_t<State_>>,
+    typename row_targets<tuple_filter_t<row_from<State_>::template test, transitions_t<TopState_>>>::type>;
+
+template <typename TopState_, typename ... State_>
+constexpr auto declared_ids(type_identity<std::tuple<State_...>>) {
+    return std::array<std::size_t, sizeof...(State_)>{index_v<State_, declared_states_t<TopState_>>...};
+}
+
+template <std::size_t N_, std::size_t K_>
+constexpr void set_parent(std::array<std::size_t, N_>& parents, std::size_t parent, std::array<std::size_t, K_> const& children) {
+    for (std::size_t child : children) {
+        parents[child] = parent;
+    }
+}
+
+template <typename TopState_, typename ... State_>
+constexpr auto declared_parents(type_identity<std::tuple<State_...>>) {
+    std::array<std::size_t, sizeof...(State_)> parents{};
+    (set_parent(parents, index_v<State_, declared_states_t<TopState_>>,
+        declared_ids<TopState_>(type_identity<typename declared_children<State_>::type>{})), ...);
+    return parents;
+}
+
+template <std::size_t N_, std::size_t K_>
+constexpr bool reach(std::array<bool, N_>& reachable, std::array<std::size_t, N_> const& parents, std::size_t state,
+        std::array<std::size_t, K_> const& targets) {
+    if (!reachable[state]) {
+        return false;
+    }
+    bool changed = false;
+    if (state != 0 && !reachable[parents[state]]) {
+        reachable[parents[state]] = changed = true;
+    }
+    for (std::size_t target : targets) {
+        if (!reachable[target]) {
+            reachable[target] = changed = true;
+        }
+    }
+    return changed;
+}
+
+template <typename TopState_, typename ... State_>
+constexpr auto reachable_states(type_identity<std::tuple<State_...>> states) {
+    const auto parents = declared_parents<TopState_>(states);
+    std::array<bool, sizeof...(State_)> reachable{};
+    reachable[0] = true;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        ((changed |= reach(reachable, parents, index_v<State_, declared_states_t<TopState_>>,
+            declared_ids<TopState_>(type_identity<reach_edges_t<TopState_, State_>>{}))), ...);
+    }
+    return reachable;
+}
+
+// Reachability of each state of declared_states_t<TopState_>.
+template <typename TopState_>
+constexpr auto reachable_v = reachable_states<TopState_>(type_identity<declared_states_t<TopState_>>{});
+
+template <typename TopState_>
+struct is_reachable
+{
+    template <typename State_>
+    using test = std::bool_constant<reachable_v<TopState_>[index_v<State_, declared_states_t<TopState_>>]>;
+};
+
+template <typename State_>
+struct live_sub_states<State_, std::enable_if_t<!prunes_unreachable_v<top_state_t<State_>>>>
+{
+    using type = typename State_::SubStates;
+};
+
+template <typename State_>
+struct live_sub_states<State_, std::enable_if_t<prunes_unreachable_v<top_state_t<State_>>>>
+{
+    using type = tuple_filter_t<is_reachable<top_state_t<State_>>::template test, typename State_::SubStates>;
+};
+
+template <typename TopState_, bool = prunes_unreachable_v<TopState_>>
+struct pruned_states { using type = std::tuple<>; };
+
+template <typename TopState_>
+struct pruned_states<TopState_, true>
+{
+    template <typename State_>
+    using test = std::bool_constant<!is_reachable<TopState_>::template test<State_>::value>;
+    using type = tuple_filter_t<test, declared_states_t<TopState_>>;
+};
+
+// States removed from the machine by reachability pruning, for diagnostics
+// (see also pruned_state_names in trace.hpp).
+template <typename TopState_>
+using pruned_states_t = typename pruned_states<TopState_>::type;
+
+// States active right after entering State_ without a target.
+template <typename State_, typename StateBase_ = base_t<State_>>
+struct initial_configuration;
+
+template <typename State_>
+using initial_configuration_t = typename initial_configuration<State_>::type;
+
+template <typename State_>
+struct initial_configuration<State_, SimpleStateBase>
+{
+    using type = std::tuple<State_>;
+};
+
+template <typename State_>
+struct initial_configuration<State_, CompositeStateBase>
+{
+    using type = tuple_join_t<State_, initial_configuration_t<initial_state_t<State_>>>;
+};
+
+template <typename Regions_>
+struct initial_configuration_regions;
+
+template <typename ... Region_>
+struct initial_configuration_regions<std::tuple<Region_...>>
+{
+    using type = tuple_join_t<initial_configuration_t<Region_>...>;
+};
+
+template <typename State_>
+struct initial_configuration<State_, OrthogonalStateBase>
+{
+    using type = tuple_join_t<State_, typename initial_configuration_regions<typename State_::Regions>::type>;
+};
+
 template <typename State_>
 class SimpleStateWrapper;
 
@@ -289,6 +702,9 @@ class CompositeStateWrapper;
 template <typename State_>
 class OrthogonalStateWrapper;
 
+template <typename State_>
+class SharedCompositeWrapper;
+
 template <typename State_, typename StateBase_ = base_t<State_>>
 struct wrapper;
 
@@ -296,7 +712,10 @@ template <typename State_>
 struct wrapper<State_, SimpleStateBase> { using type = SimpleStateWrapper<State_>; };
 
 template <typename State_>
-struct wrapper<State_, CompositeStateBase> { using type = CompositeStateWrapper<State_>; };
+struct wrapper<State_, CompositeStateBase>
+{
+    using type = std::conditional_t<shared_body_v<State_>, SharedCompositeWrapper<State_>, CompositeStateWrapper<State_>>;
+};
 
 template <typename State_>
 struct wrapper<State_, OrthogonalStateBase> { using type = OrthogonalStateWrapper<State_>; };
@@ -325,6 +744,20 @@ struct all_regions<std::tuple<OrthogonalState_...>>
 template <typename TopState_>
 using all_regions_t = tuple_join_t<TopState_, typename all_regions<orthogonal_states_t<all_states_t<TopState_>>>::type>;
 
+template <typename TopState_, typename ... State_>
+constexpr int innermost_region_priority(type_identity<std::tuple<State_...>>)
+{
+    int priority = 0;
+    bool found = false;
+    ((found = found || (tuple_contains_v<State_, all_regions_t<TopState_>> && ((priority = region_priority_v<State_>), true))), ...);
+    return priority;
+}
+
+// Priority of the innermost region containing State_ (or being State_).
+template <typename State_>
+constexpr int state_region_priority_v = innermost_region_priority<top_state_t<State_>>(
+    type_identity<tuple_join_t<State_, super_state_recursive_t<State_>>>{});
+
 template <typename Region_, typename RegionNext_, typename ... RegionRest_>
 constexpr auto region_mask(type_identity<std::tuple<RegionNext_, RegionRest_...>>)
 {
@@ -341,7 +774,7 @@ constexpr auto region_mask(type_identity<std::tuple<RegionNext_, RegionRest_...>
 };
 
 template <typename TopState_>
-using RegionMasks = std::array<std::size_t, std::tuple_size_v<all_regions_t<TopState_>>>;
+using RegionMasks = std::array<state_combination_t<TopState_>, std::tuple_size_v<all_regions_t<TopState_>>>;
 
 template <typename TopState_, typename ... Region_>
 constexpr RegionMasks<TopState_> region_masks(type_identity<std::tuple<Region_...>>)
@@ -354,11 +787,66 @@ constexpr RegionMasks<TopState_> region_masks_v
     = region_masks<TopState_>(type_identity<all_regions_t<TopState_>>{});
 
 
+// Whether two target branches diverge both ways inside the region of mask:
+// each enters a state of it the other does not.
+template <typename StateCombination_>
+constexpr bool diverge_in(StateCombination_ c1, StateCombination_ c2, StateCombination_ mask) {
+    return ((c1 & ~c2) & mask) && ((c2 & ~c1) & mask);
+}
+
+// Two target branches conflict if they diverge in any region. Every region
+// must agree: a region neither branch touches does not make them valid.
 template <typename TopState_>
 constexpr bool is_valid(state_combination_t<TopState_> const& c1, state_combination_t<TopState_> const& c2) {
     constexpr auto& masks = region_masks_v<TopState_>;
     return !c1 || !c2 || std::apply([&](auto& ... mask) {
-        return ((!((c1 & ~c2) & mask) || !((c2 & ~c1) & mask)) || ...);
+        return (!diverge_in(c1, c2, mask) && ...);
+    }, masks);
+}
+
+// States a transition to State_ may add to the target branch, besides the top
+// state every branch shares: its ancestors, itself and, through history, its
+// descendants.
+template <typename State_>
+constexpr auto transition_branch_v = (state_combination_v<super_state_recursive_t<State_>> | state_combination_recursive_v<State_>)
+    & ~state_combination_v<top_state_t<State_>>;
+
+template <typename TopState_, typename State_>
+constexpr std::size_t transition_mask_count() {
+    std::size_t count = 0;
+    for (auto mask : region_masks_v<TopState_>) {
+        count += (mask & transition_branch_v<State_>) != 0;
+    }
+    return count;
+}
+
+template <typename TopState_, typename State_>
+constexpr auto transition_masks() {
+    std::array<state_combination_t<TopState_>, transition_mask_count<TopState_, State_>()> masks{};
+    std::size_t i = 0;
+    for (auto mask : region_masks_v<TopState_>) {
+        if (mask & transition_branch_v<State_>) {
+            masks[i++] = mask;
+        }
+    }
+    return masks;
+}
+
+// The region masks a transition to State_ can conflict in; the other regions
+// are left out of its validity check at compile time.
+template <typename TopState_, typename State_>
+constexpr auto transition_masks_v = transition_masks<TopState_, State_>();
+
+// Whether a transition to State_ is valid whatever else has been targeted.
+template <typename TopState_, typename State_>
+constexpr bool is_always_valid_v = transition_masks_v<TopState_, State_>.size() == 0;
+
+// is_valid() for c2 being the branch of a transition to State_.
+template <typename TopState_, typename State_>
+constexpr bool is_valid_transition(state_combination_t<TopState_> const& c1, state_combination_t<TopState_> const& c2) {
+    constexpr auto& masks = transition_masks_v<TopState_, State_>;
+    return !c1 || std::apply([&](auto& ... mask) {
+        return (!diverge_in(c1, c2, mask) && ...);
     }, masks);
 }
 
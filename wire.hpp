@@ -0,0 +1,219 @@
+// Copyright 2025 Zoltán Rési
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <type_traits>
+#include <tuple>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#if __has_include(<version>)
+#include <version>
+#endif
+#if defined(__cpp_lib_start_lifetime_as)
+#include <memory>
+#endif
+
+namespace metahsm {
+
+// A wire frame is a 16-bit event id in native byte order, zero padding up to
+// the alignment of the event, then the raw bytes of the event, which must be
+// trivially copyable. Frames starting at an address aligned for the event thus
+// carry it aligned as well.
+constexpr std::size_t wire_header_size = sizeof(std::uint16_t);
+
+// Events declare `static constexpr std::uint16_t wire_id`; specialize this
+// trait for event types that cannot be modified.
+template <typename Event_>
+struct wire_traits
+{
+    static constexpr std::uint16_t id = Event_::wire_id;
+    static constexpr std::size_t size = sizeof(Event_);
+};
+
+// Offset of the event in its frame, the size of the frame and the frame
+// itself, written to out.
+template <typename Event_>
+constexpr std::size_t wire_payload_offset_v = (wire_header_size + alignof(Event_) - 1) / alignof(Event_) * alignof(Event_);
+
+template <typename Event_>
+constexpr std::size_t wire_frame_size_v = wire_payload_offset_v<Event_> + wire_traits<Event_>::size;
+
+template <typename Event_>
+std::size_t write_wire_frame(Event_ const& event, std::byte* out) {
+    const std::uint16_t id = wire_traits<Event_>::id;
+    std::memcpy(out, &id, wire_header_size);
+    std::memset(out + wire_header_size, 0, wire_payload_offset_v<Event_> - wire_header_size);
+    std::memcpy(out + wire_payload_offset_v<Event_>, &event, wire_traits<Event_>::size);
+    return wire_frame_size_v<Event_>;
+}
+
+// The event of a frame of Event_, in place: trivially copyable events are
+// implicit-lifetime types, so the bytes received into the frame already form
+// one. Requires the payload to be aligned for Event_ (see wire_payload_aligned).
+template <typename Event_>
+const Event_& wire_event_view(const std::byte* frame) {
+    const std::byte* payload = frame + wire_payload_offset_v<Event_>;
+#if defined(__cpp_lib_start_lifetime_as)
+    return *std::start_lifetime_as<Event_>(payload);
+#else
+    return *std::launder(reinterpret_cast<const Event_*>(payload));
+#endif
+}
+
+template <typename Event_>
+bool wire_payload_aligned(const std::byte* frame) {
+    return reinterpret_cast<std::uintptr_t>(frame + wire_payload_offset_v<Event_>) % alignof(Event_) == 0;
+}
+
+// The event of a frame of Event_, copied out of it: the fallback for frames
+// whose payload is misaligned. The fixed-size copy compiles to plain loads.
+template <typename Event_>
+Event_ read_wire_event(const std::byte* frame) {
+    const std::byte* payload = frame + wire_payload_offset_v<Event_>;
+#if defined(__cpp_lib_bit_cast)
+    std::array<std::byte, sizeof(Event_)> bytes;
+    std::memcpy(bytes.data(), payload, sizeof(Event_));
+    return std::bit_cast<Event_>(bytes);
+#else
+    if constexpr (std::is_default_constructible_v<Event_>) {
+        Event_ event;
+        std::memcpy(&event, payload, sizeof(Event_));
+        return event;
+    }
+    else {
+        // memcpy() implicitly creates the trivially copyable event in storage
+        alignas(Event_) std::byte storage[sizeof(Event_)];
+        std::memcpy(storage, payload, sizeof(Event_));
+        return *std::launder(reinterpret_cast<Event_*>(storage));
+    }
+#endif
+}
+
+// Outcome of dispatching a frame: no state reacted to the event, some state
+// did, or the frame was rejected for an unknown id or a size mismatch.
+enum class WireStatus : std::uint8_t
+{
+    ignored,
+    reacted,
+    rejected
+};
+
+template <typename Event_, typename _SFINAE = void>
+struct is_wire_event : std::false_type {};
+
+template <typename Event_>
+struct is_wire_event<Event_, std::void_t<decltype(wire_traits<Event_>::id)>>
+    : std::bool_constant<std::is_trivially_copyable_v<Event_>> {};
+
+template <typename Event_>
+constexpr bool is_wire_event_v = is_wire_event<Event_>::value;
+
+template <typename _Entity, typename _SFINAE = void>
+struct wire_events { using type = std::tuple<>; };
+
+template <typename _Entity>
+struct wire_events<_Entity, std::void_t<typename _Entity::WireEvents>> { using type = typename _Entity::WireEvents; };
+
+template <typename _Entity>
+using wire_events_t = typename wire_events<_Entity>::type;
+
+// Perfect hash over the wire ids of an event list: slot = (id * multiplier) >> shift.
+// The multiplier is searched at compile time so that no two ids share a slot;
+// the search gives up after wire_hash_attempts multipliers and leaves it 0.
+constexpr std::uint32_t wire_hash_attempts = 4096;
+
+template <std::size_t N_>
+struct WireHash
+{
+    static constexpr std::size_t bits = [] {
+        std::size_t b = 1;
+        while ((std::size_t{1} << b) < 2 * N_) { b++; }
+        return b;
+    }();
+    static constexpr std::size_t size = std::size_t{1} << bits;
+    static constexpr std::uint8_t empty = 0xff;
+    static_assert(N_ < empty, "too many wire events");
+
+    std::uint32_t multiplier = 0;
+    std::array<std::uint16_t, size> keys{};
+    std::array<std::uint8_t, size> handlers{};
+
+    constexpr std::size_t slot(std::uint16_t id) const {
+        return static_cast<std::uint32_t>(id * multiplier) >> (32 - bits);
+    }
+
+    constexpr std::size_t find(std::uint16_t id) const {
+        const std::size_t s = slot(id);
+        return handlers[s] != empty && keys[s] == id ? handlers[s] : empty;
+    }
+};
+
+template <std::size_t N_>
+constexpr WireHash<N_> make_wire_hash(std::array<std::uint16_t, N_> const& ids) {
+    WireHash<N_> hash;
+    std::uint32_t candidate = 0x9e3779b1u;
+    for (std::uint32_t attempt = 0; attempt < wire_hash_attempts; attempt++, candidate += 2) {
+        hash.multiplier = candidate;
+        for (auto& handler : hash.handlers) { handler = WireHash<N_>::empty; }
+        bool collision = false;
+        for (std::size_t i = 0; i < N_ && !collision; i++) {
+            const std::size_t s = hash.slot(ids[i]);
+            collision = hash.handlers[s] != WireHash<N_>::empty;
+            hash.keys[s] = ids[i];
+            hash.handlers[s] = static_cast<std::uint8_t>(i);
+        }
+        if (!collision) {
+            return hash;
+        }
+    }
+    hash.multiplier = 0;
+    return hash;
+}
+
+template <std::size_t N_>
+constexpr bool unique_wire_ids(std::array<std::uint16_t, N_> const& ids) {
+    for (std::size_t i = 0; i < N_; i++) {
+        for (std::size_t j = 0; j < i; j++) {
+            if (ids[i] == ids[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename Events_>
+struct wire_hash;
+
+template <typename ... Event_>
+struct wire_hash<std::tuple<Event_...>>
+{
+    static_assert((is_wire_event_v<Event_> && ...), "wire events need a wire_id and a trivially copyable layout");
+    static constexpr std::array<std::uint16_t, sizeof...(Event_)> ids{wire_traits<Event_>::id...};
+    static_assert(unique_wire_ids(ids), "duplicate wire id");
+    static constexpr auto value = make_wire_hash(ids);
+    static_assert(value.multiplier != 0, "no perfect hash found for these wire ids, change one of them");
+};
+
+template <typename Events_>
+constexpr auto wire_hash_v = wire_hash<Events_>::value;
+
+}